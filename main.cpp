@@ -22,11 +22,128 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 // Max span of on or off is 2 seconds at 48 kHz
 #define MAX_SPAN       (2*48000)
 // Samples needed to change on/off
 #define RADIO_FLICKER  5
+// --flicker auto tries this many flickers from a quarter of a bit, halving each time
+#define AUTO_FLICKER_CANDIDATES 4
+
+// Samples per block (a multiple of 64)
+#define SAMPLE_BLOCK_SIZE 65536
+// Blocks in flight with --pipeline
+#define PIPELINE_BLOCKS   8
+
+// Buffers at least half a huge page are mapped on their own and ask for huge pages. See allocLarge()
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Kinds of large buffers and how they were backed for --stats
+#define LARGE_COUNTS  0
+#define LARGE_BLOCKS  1
+#define LARGE_SAMPLES 2
+#define LARGE_COUNT   3
+#define PAGES_EXPLICIT    0
+#define PAGES_TRANSPARENT 1 // Requested, the kernel may not back them with huge pages
+#define PAGES_NORMAL      2
+#define PAGES_COUNT       3
+
+// A consumer returns this to end a pass early without an error
+#define PIPELINE_DONE UINT32_MAX
+
+// Stages of a pass over the samples. See runPipeline()
+#define STAGE_READ      0
+#define STAGE_THRESHOLD 1
+#define STAGE_SPANS     2
+#define STAGE_COUNT     3
+
+// Thresholds tried with --multi-threshold
+#define THRESHOLD_CANDIDATES 8
+#define THRESHOLD_MIN_BITS   16 // Fewer bits than this can fit any bit width
+
+// Mean squared error in bits under which spans fit a bit width (about 0.07 bits RMS)
+#define FIT_MAX_ERROR 0.005
+
+// --tune grid
+#define TUNE_LEVELS      9              // Threshold levels from 0.1 to 0.9 of the on/off range
+#define TUNE_FLICKERS    8              // Flickers 1, 2, 3, 5, 8, 13, 21 and 34
+#define TUNE_MAX_SAMPLES (16 * 1048576) // Most samples read
+
+// --spectrogram defaults
+#define SPECTROGRAM_FFT_SIZE     256
+#define SPECTROGRAM_ACTIVITY_DB  12.0
+#define SPECTROGRAM_SPLATTER_DB  25.0
+#define SPECTROGRAM_HANGOVER     8192
+// Frames used to find the noise floor of each bin
+#define SPECTROGRAM_FLOOR_FRAMES 4096
+// Active frames needed for a bin to be part of a region
+#define SPECTROGRAM_MIN_FRAMES   2
+
+// --downconvert defaults
+#define DOWNCONVERT_DECIMATION 8
+// Samples mixed at a time (a multiple of the decimation is used)
+#define DOWNCONVERT_BLOCK      1024
+// Frames averaged to find the carrier with --downconvert auto
+#define DOWNCONVERT_AUTO_FRAMES 4096
+// Groups of --fsk averaged for the magnitude that finds silence (odd)
+#define FSK_SQUELCH_GROUPS     15
+
+// --preamble defaults
+#define PREAMBLE_CORRELATION 6.0
+// Off bits that end a packet without --packet-bits
+#define PREAMBLE_GAP_BITS    32
+// A packet's preamble can have 1 bit error per this many bits
+#define PREAMBLE_ERROR_BITS  16
+// Longer templates are correlated with FFTs
+#define PREAMBLE_DIRECT_MAX  64
+
+// --rectify defaults
+#define RECTIFY_WINDOW    64
+// The DC level is the average of RECTIFY_DC_GROUPS groups of RECTIFY_GROUP samples
+#define RECTIFY_GROUP     64
+#define RECTIFY_DC_GROUPS 64
+
+// --bursts defaults
+#define BURST_LEVEL      8.0
+// Active samples needed for a burst
+#define BURST_MIN_ACTIVE 16
+#define BURST_INDEX_TAG     0x424b4f4f // "OOKB"
+#define BURST_INDEX_VERSION 1
+#define ARCHIVE_TAG         0x414b4f4f // "OOKA"
+#define ARCHIVE_VERSION     1
+
+// Changes when the same options give different output
+#define CACHE_VERSION 1
+
+// --overview pyramid. Level 0 entries cover 256 samples and each level covers 256 times more.
+#define OVERVIEW_LEVELS      3
+#define OVERVIEW_LEVEL_SHIFT 8
+#define OVERVIEW_TAG         0x4f4b4f4f // "OOKO"
+#define OVERVIEW_VERSION     1
 
 struct wavHeader
 {
@@ -45,6 +162,84 @@ struct wavHeader
 	uint32_t dataSize;
 };
 
+/**
+ * Start of an --overview file. Followed by each level's entries, level 0 first.
+ */
+struct overviewHeader
+{
+	uint32_t tag;        // "OOKO"
+	uint32_t version;    // 1
+	uint32_t fileFormat; // Of the samples
+	uint32_t sampleRate; // 0 if unknown
+	uint64_t numSamples;
+	uint32_t numLevels;
+	uint32_t levelShift; // Entries in level n cover 1 << (levelShift * (n + 1)) samples
+};
+
+/**
+ * An --overview entry. The last entry of each level can cover fewer samples.
+ */
+struct overviewEntry
+{
+	uint32_t min;
+	uint32_t max;
+	double   energy; // Mean square of samples from the zero level
+};
+
+/**
+ * Settings from the command line.
+ */
+struct decodeOptions
+{
+	uint32_t spectrogram; // Only demodulate the active regions of an I/Q file
+	uint32_t fftSize;     // FFT size for spectrogram
+	double   activityDb;  // How far above the noise floor is active
+	double   splatterDb;  // How far below a region at the same time is splatter
+	uint32_t hangover;    // Max samples between active bins in the same region
+	uint32_t pipelined;   // Run the stages of each pass on their own threads
+	uint32_t stats;       // Output timing stats
+	uint32_t jobs;        // Number of threads decoding spectrogram regions, bursts or files
+	uint32_t iq;          // File is I/Q
+	uint32_t downconvert; // Mix a carrier down to 0 Hz before demodulating
+	uint32_t carrierAuto; // Estimate the carrier frequency
+	uint32_t fsk;         // Demodulate the frequency instead of the amplitude
+	double   carrierHz;   // The carrier frequency
+	uint32_t decimation;  // Decimation after downconverting
+	uint32_t sampleRate;  // Sample rate of raw files
+	const char *preamble; // Bits to correlate with to find packets or NULL
+	double   bitWidth;    // Samples per bit for the preamble or 0 to measure it
+	uint32_t packetBits;  // Bits per packet or 0 to end at a gap
+	double   correlation; // How far above the noise a correlation peak is
+	uint32_t bursts;      // Normalize each burst on its own
+	double   burstLevel;  // How far above the noise floor is active
+	uint32_t rectify;     // Length of the low pass filter for AC coupled audio or 0
+	uint32_t multiThreshold; // Try several thresholds and use the best one
+	const char *overview; // Write an overview to this file or NULL
+	double   queryStep;   // Seconds per row when querying an overview or 0
+	const char *writeIndex; // Write the bursts to this file or NULL
+	const char *readIndex;  // Read the bursts from this file instead of finding them or NULL
+	const char *cacheDir;   // Directory of decoded output or NULL
+	FILE    *pulseFile;   // Export spans as rtl_433 pulse data to this file or NULL
+	uint32_t importPulses; // File is rtl_433 pulse data instead of samples
+	uint32_t continuous;  // Files are one recording
+	uint32_t watch;       // File is a directory to decode files from as they are written
+	const char *processed; // Record of files decoded by watch or NULL for the default
+	uint32_t maxMessages; // Stop after this many messages or 0 for no limit
+	const char *match;    // Only messages with these bits (0s and 1s) or NULL
+	double   prefix;      // Seconds (or samples) measured or 0 for all of them
+	const char *start;    // Time or sample to start decoding at or NULL (see parseTime())
+	const char *end;      // Time or sample to stop decoding at or NULL
+	uint64_t memoryLimit; // Bytes to plan the decode to fit in or 0 for no limit
+	uint32_t countShift;  // Low bits of samples left out of the counts (set by the plan)
+	const char *extract;  // Directory to write each burst to as a .wav file or NULL
+	const char *padding;  // Time (or before,after) kept around each extracted burst or NULL for its margins
+	uint64_t windowStart; // Sample of the file the stream starts at (set by --start)
+	const char *archive;  // Write the bursts and the levels between them to this file or NULL
+	uint32_t flicker;     // Samples in a row needed to change on/off or 0 for a fraction of the bit width
+	double   thresholdLevel; // Where the threshold is from off (0) to on (1)
+	uint32_t tune;        // Output the settings that measure best instead of the data
+};
+
 /**
  * Make a file format value give the file's format.
  *
@@ -77,69 +272,18 @@ uint32_t getSampleByteSize(uint32_t fileFormat)
 }
 
 /**
- * Reads a sample from the input file.
+ * Converts the raw bytes of a sample to an unsigned value.
  *
- * @param fin        - The input file at an offset into the data
+ * @param sample8    - The raw bytes of the sample
  * @param fileFormat - The file format
- * @param error      - Set to non-zero if there's an error
- * @return The value of the sample or UINT32_MAX on error
+ * @return The value of the sample
  */
-uint32_t getSample(FILE *fin, uint32_t fileFormat, uint32_t *error = NULL)
+uint32_t decodeSample(const uint8_t *sample8, uint32_t fileFormat)
 {
 	uint32_t sampleSize     = ( fileFormat        &    3) + 1;
-	uint32_t channels       = ((fileFormat >>  2) & 0xff) + 1;
-	uint32_t channel        =  (fileFormat >> 10) & 0xff;
 	uint32_t isSigned       =  (fileFormat >> 18) &    1;
 	uint32_t isLittleEndian =  (fileFormat >> 19) &    1;
 	uint32_t sample = 0;
-	uint8_t  sample8[4];
-
-	if (channels > 1)
-	{
-		if (fseek(fin, sampleSize * channel, SEEK_CUR))
-		{
-			if (!feof(fin))
-			{
-				perror("fseek");
-			}
-			if (error != NULL)
-			{
-				*error = 1;
-			}
-			return UINT32_MAX;
-		}
-	}
-	if (fread(sample8, sampleSize, 1, fin) != 1)
-	{
-		if (!feof(fin))
-		{
-			perror("fread");
-		}
-		if (error != NULL)
-		{
-			*error = 1;
-		}
-		return UINT32_MAX;
-	}
-	if (channels > 1)
-	{
-		if (fseek(fin, sampleSize * (channels - channel - 1), SEEK_CUR))
-		{
-			if (!feof(fin))
-			{
-				perror("fseek");
-			}
-			if (error != NULL)
-			{
-				*error = 1;
-			}
-			return UINT32_MAX;
-		}
-	}
-	if (error != NULL)
-	{
-		*error = 0;
-	}
 
 	// Endian
 	if (isLittleEndian)
@@ -162,590 +306,8205 @@ uint32_t getSample(FILE *fin, uint32_t fileFormat, uint32_t *error = NULL)
 	// Signed to unsigned
 	if (isSigned)
 	{
-		sample = (sample + (1 << (8 * sampleSize - 1))) & ((1 << (8 * sampleSize)) - 1);
+		sample = (uint32_t) ((sample + (((uint64_t) 1) << (8 * sampleSize - 1))) & ((((uint64_t) 1) << (8 * sampleSize)) - 1));
 	}
 
 	return sample;
 }
 
 /**
- * Counts samples of each value.
+ * Converts the raw bytes of frames to unsigned values of one channel.
  *
- * @param counts     - A pointer to integers that receive the number of samples with said value
- * @param fin        - The input file at the offset of where the data starts
+ * @param samples    - Receives count values
+ * @param raw        - The raw bytes of count frames
+ * @param count      - Number of frames
  * @param fileFormat - The file format
- * @return The total number of samples or UINT32_MAX on error
  */
-uint32_t getCounts(uint32_t *counts, FILE *fin, uint32_t fileFormat)
+static inline __attribute__((always_inline)) void convertSamplesBody(uint32_t *samples, const uint8_t *raw, uint32_t count, uint32_t fileFormat)
 {
-	uint32_t count     = 0;
-	uint32_t error     = 0;
-	size_t   numCounts = ((size_t) 1) << (8 * getSampleByteSize(fileFormat));
+	uint32_t       sampleSize     = ( fileFormat        &    3) + 1;
+	uint32_t       channels       = ((fileFormat >>  2) & 0xff) + 1;
+	uint32_t       isSigned       =  (fileFormat >> 18) &    1;
+	uint32_t       isLittleEndian =  (fileFormat >> 19) &    1;
+	uint32_t       frameSize      = sampleSize * channels;
+	uint32_t       signBit        = isSigned << (8 * sampleSize - 1);
+	const uint8_t *in             = raw + sampleSize * ((fileFormat >> 10) & 0xff);
 
-	for (size_t i = 0; i < numCounts; i++)
+	// Signed to unsigned is flipping the sign bit
+	if (sampleSize == 1)
 	{
-		counts[i] = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			samples[i] = in[frameSize * i] ^ signBit;
+		}
 	}
-	while (!feof(fin))
+	else if (sampleSize == 2 && isLittleEndian && channels == 1)
 	{
-		uint32_t sample = getSample(fin, fileFormat, &error);
-
-		if (error)
+		for (uint32_t i = 0; i < count; i++)
 		{
-			if (feof(fin))
-			{
-				break;
-			}
-			return UINT32_MAX;
-		}
+			uint16_t sample;
 
-		counts[sample]++;
-		count++;
+			memcpy(&sample, in + 2 * i, 2);
+			samples[i] = sample ^ signBit;
+		}
 	}
-	return count;
-}
-
-/**
- * Finds a threshold value that anything above the value is on and anything below is off.
- * This is done by averaging the highest sample and lowest sample, ignoring the highest 2% and lowest 2% of samples.
- *
- * @param counts     - A constant pointer to integers that were generated from calling getCounts()
- * @param count      - The total number of samples
- * @param fileFormat - The file format
- * @return The threshold value between on and off
- */
-uint32_t findOnOffThreshold(const uint32_t *counts, uint32_t count, uint32_t fileFormat)
-{
-	size_t   numCounts = ((size_t) 1) << (8 * getSampleByteSize(fileFormat));
-	uint32_t hi = 0;
-	uint32_t lo = (uint32_t) (numCounts - 1);
-	uint32_t skipCount = count / 50; // 2%
-	uint32_t curCount = 0;
-
-	// Get hi and lo
-	for (size_t i = 0; i < numCounts; i++)
+	else if (sampleSize == 2 && isLittleEndian)
 	{
-		if (counts[i] != 0)
+		for (uint32_t i = 0; i < count; i++)
 		{
-			curCount += counts[i];
-			if (curCount > skipCount)
-			{
-				lo = (uint32_t) i;
-				break;
-			}
+			samples[i] = (in[frameSize * i] | ((uint32_t) in[frameSize * i + 1] << 8)) ^ signBit;
 		}
 	}
-	curCount = 0;
-	for (uint32_t i = (uint32_t) (numCounts - 1); i > lo; i--)
+	else if (sampleSize == 3 && isLittleEndian)
 	{
-		if (counts[i] != 0)
+		for (uint32_t i = 0; i < count; i++)
 		{
-			curCount += counts[i];
-			if (curCount > skipCount)
-			{
-				hi = i;
-				break;
-			}
+			const uint8_t *sample8 = in + frameSize * i;
+
+			samples[i] = (sample8[0] | ((uint32_t) sample8[1] << 8) | ((uint32_t) sample8[2] << 16)) ^ signBit;
 		}
 	}
-	if (lo >= hi)
+	else
 	{
-		return 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			samples[i] = decodeSample(in + frameSize * i, fileFormat);
+		}
 	}
-	return (hi + lo) / 2;
 }
 
 /**
- * Moves the file offset past the initial on/off state.
+ * Counts samples of each value.
  *
- * @param state          - Set to the first state (on/off)
- * @param radioFlicker   - Number samples needed to change the state
- * @param onOffThreshold - The threshold value between on and off
- * @param fin            - The input file at the offset of where the data starts
- * @param fileFormat     - The file format
- * @return leftOver (used by subsequent calls to getNextSpan())
+ * @param counts  - Integers that are incremented for each sample with said value
+ * @param samples - The samples
+ * @param count   - Number of samples
  */
-uint32_t ignoreFirstSpan(uint32_t &state, uint32_t radioFlicker, uint32_t onOffThreshold, FILE *fin, uint32_t fileFormat)
+static inline __attribute__((always_inline)) void countSamplesBody(uint32_t *counts, const uint32_t *samples, uint32_t count)
 {
-	uint32_t nextCount = 0;
-	uint32_t curState;
-	uint32_t newState;
-	uint32_t sample;
-	uint32_t error = 0;
-
-	// Get state
-	sample = getSample(fin, fileFormat, &error);
-	if (error)
-	{
-		if (feof(fin))
-		{
-			return 0;
-		}
-		return UINT32_MAX;
-	}
-
-	curState = 1; // on
-	if (sample < onOffThreshold)
+	for (uint32_t i = 0; i < count; i++)
 	{
-		curState = 0; // off
+		counts[samples[i]]++;
 	}
+}
 
-	// Read samples
-	while (!feof(fin))
+/**
+ * Converts samples to on/off states. Anything at or above the threshold is on.
+ *
+ * @param bits           - Receives (count+63)/64 words (sample i is bit i%64 of bits[i/64])
+ * @param samples        - The samples
+ * @param count          - Number of samples
+ * @param onOffThreshold - The threshold value between on and off
+ */
+static inline __attribute__((always_inline)) void thresholdSamplesBody(uint64_t *bits, const uint32_t *samples, uint32_t count, uint32_t onOffThreshold)
+{
+	for (uint32_t i = 0; i < count; i += 64)
 	{
-		sample = getSample(fin, fileFormat, &error);
-		if (error)
-		{
-			if (feof(fin))
-			{
-				break;
-			}
-			return UINT32_MAX;
-		}
+		uint32_t end  = std::min(count - i, (uint32_t) 64);
+		uint64_t word = 0;
 
-		newState = 1; // on
-		if (sample < onOffThreshold)
+		for (uint32_t j = 0; j < end; j++)
 		{
-			newState = 0; // off
-		}
-		if (newState != curState)
-		{
-			nextCount++;
-			if (nextCount > radioFlicker)
-			{
-				return nextCount;
-			}
-		}
-		else
-		{
-			nextCount = 0;
+			word |= ((uint64_t) (samples[i + j] >= onOffThreshold)) << j;
 		}
+		bits[i / 64] = word;
 	}
-	return 0;
 }
 
 /**
- * Moves the file offset to the next on/off state and returns number of samples in the current state.
+ * Finds the next sample that isn't in a state.
  *
- * @param state          - Set to the first state (on/off). Do not modify this between call of ignoreFirstSpan() or getNextSpan()
- * @param radioFlicker   - Number samples needed to change the state
- * @param onOffThreshold - The threshold value between on and off
- * @param fin            - The input file at the offset of where the data starts
- * @param fileFormat     - The file format
- * @param leftOver       - The left over from the previous call of ignoreFirstSpan() or getNextSpan()
- * @return The number of samples of state
+ * @param bits  - On/off states from thresholdSamples()
+ * @param pos   - The first sample to check
+ * @param count - Number of samples
+ * @param same  - All zeros for off or all ones for on
+ * @return The index of the next sample not in the state or count
  */
-uint32_t getNextSpan(uint32_t &state, uint32_t radioFlicker, uint32_t onOffThreshold, FILE *fin, uint32_t fileFormat, uint32_t &leftOver)
+static inline __attribute__((always_inline)) uint32_t findChangeBody(const uint64_t *bits, uint32_t pos, uint32_t count, uint64_t same)
 {
-	uint32_t count = leftOver;
-	uint32_t nextCount = 0;
-	uint32_t curState = 0;
-	uint32_t newState;
-	uint32_t error = 0;
-
-	// Flip state
-	if (state == 0)
+	while (pos < count)
 	{
-		curState = 1;
-	}
-	state = curState;
-
-	// Read samples
-	while (!feof(fin))
-	{
-		uint32_t sample = getSample(fin, fileFormat, &error);
-
-		if (error)
-		{
-			if (feof(fin))
-			{
-				break;
-			}
-			return UINT32_MAX;
-		}
+		uint64_t diff = (bits[pos / 64] ^ same) >> (pos % 64);
 
-		newState = 1; // on
-		if (sample < onOffThreshold)
-		{
-			newState = 0; // off
-		}
-		if (newState != curState)
-		{
-			nextCount++;
-			if (nextCount > radioFlicker)
-			{
-				leftOver = nextCount;
-				return count;
-			}
-		}
-		else
+		if (diff != 0)
 		{
-			count += nextCount + 1;
-			nextCount = 0;
+			pos += __builtin_ctzll(diff);
+			break;
 		}
+		pos += 64 - pos % 64;
 	}
+	return std::min(pos, count);
+}
 
-	// Ignore last span
-	return 0;
+/**
+ * Counts how many samples in a row have the same state.
+ *
+ * @param bits  - On/off states from thresholdSamples()
+ * @param pos   - The first sample
+ * @param count - Number of samples
+ * @return The number of samples starting at pos with the same state
+ */
+static inline __attribute__((always_inline)) uint32_t getRunLengthBody(const uint64_t *bits, uint32_t pos, uint32_t count)
+{
+	return findChangeBody(bits, pos, count, 0 - ((bits[pos / 64] >> (pos % 64)) & 1)) - pos;
 }
 
 /**
- * Counts spans of samples in either on or off states.
+ * Converts 8 nibbles, one per byte, to hex digits.
  *
- * @param spans          - An array of maxSpan+1 integers
- * @param maxSpan        - The max span to record
- * @param onOffThreshold - The threshold value between on and off
- * @param fin            - The input file at the offset of where the data starts
- * @param fileFormat     - The file format
- * @return The max span or UINT32_MAX on error
+ * @param nibbles - Values 0 to 15 in each byte
+ * @return The ASCII hex digits
  */
-uint32_t getSpans(uint32_t *spans, uint32_t maxSpan, uint32_t onOffThreshold, FILE *fin, uint32_t fileFormat)
+static inline __attribute__((always_inline)) uint64_t hexDigits(uint64_t nibbles)
 {
-	uint32_t leftOver;
-	uint32_t realMaxSpan = 0;
-	uint32_t count;
-	uint32_t state = 0; // 0 = off, 1 = on
+	// 1 in each byte that is 10 or more
+	uint64_t letters = ((nibbles + 0x0606060606060606) >> 4) & 0x0101010101010101;
 
-	if (maxSpan == UINT32_MAX)
-	{
-		maxSpan = UINT32_MAX - 1;
-	}
-	for (uint32_t i = 0; i <= maxSpan; i++)
+	return nibbles + 0x3030303030303030 + letters * ('a' - '0' - 10);
+}
+
+/**
+ * Stores the hex digits of 32 bits with the most significant nibble first.
+ *
+ * @param out    - Receives 8 characters
+ * @param spread - The nibbles of the 32 bits spread into the low nibble of each byte
+ */
+static inline __attribute__((always_inline)) void storeHexDigits(char *out, uint64_t spread)
+{
+	uint64_t digits = hexDigits(spread);
+
+	for (uint32_t i = 0; i < 8; i++)
 	{
-		spans[i] = 0;
+		out[i] = (char) (digits >> (56 - 8 * i));
 	}
-	leftOver = ignoreFirstSpan(state, RADIO_FLICKER, onOffThreshold, fin, fileFormat);
-	if (leftOver == UINT32_MAX)
+}
+
+/**
+ * Formats message bits as hex. The generic spread of nibbles into bytes.
+ *
+ * @param out      - Receives 16 characters per word
+ * @param words    - The bits (first bit in the most significant bit of the first word)
+ * @param numWords - The number of words
+ */
+static inline __attribute__((always_inline)) void formatHexBody(char *out, const uint64_t *words, uint64_t numWords)
+{
+	for (uint64_t i = 0; i < 2 * numWords; i++)
 	{
-		return UINT32_MAX;
+		uint64_t x = (words[i / 2] >> (32 - 32 * (i % 2))) & 0xffffffff;
+
+		x = (x | (x << 16)) & 0x0000ffff0000ffff;
+		x = (x | (x <<  8)) & 0x00ff00ff00ff00ff;
+		x = (x | (x <<  4)) & 0x0f0f0f0f0f0f0f0f;
+		storeHexDigits(out + 8 * i, x);
 	}
+}
 
-	while (1)
+/**
+ * Multiplies complex samples by an oscillator.
+ *
+ * @param re    - Real parts (mixed in place)
+ * @param im    - Imaginary parts (mixed in place)
+ * @param oscRe - Real parts of the oscillator
+ * @param oscIm - Imaginary parts of the oscillator
+ * @param count - Number of samples
+ */
+static inline __attribute__((always_inline)) void mixSamplesBody(float *re, float *im, const float *oscRe, const float *oscIm, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
 	{
-		count = getNextSpan(state, RADIO_FLICKER, onOffThreshold, fin, fileFormat, leftOver);
-		if (count == UINT32_MAX)
-		{
-			return UINT32_MAX;
-		}
-		if (count == 0)
-		{
-			break; // EOF
-		}
+		float r = re[i] * oscRe[i] - im[i] * oscIm[i];
 
-		if (realMaxSpan < count)
-		{
-			realMaxSpan = count;
-		}
-		if (count <= maxSpan)
-		{
-			spans[count]++;
-		}
+		im[i] = re[i] * oscIm[i] + im[i] * oscRe[i];
+		re[i] = r;
 	}
-	return realMaxSpan;
 }
 
 /**
- * Finds the width of a single bit in number of samples.
+ * Full-wave rectifies samples around a DC level.
  *
- * @param spans   - An array of at least maxSpan+1 integers
- * @param maxSpan - The max span to record
- * @return The width of a single bit in number of samples or 0 on error
+ * @param samples - The samples (rectified in place)
+ * @param count   - Number of samples
+ * @param dc      - The DC level
+ * @return The sum of the samples before rectifying
  */
-uint32_t findSingleBitWidth(const uint32_t *spans, uint32_t maxSpan)
+static inline __attribute__((always_inline)) uint64_t rectifySamplesBody(uint32_t *samples, uint32_t count, uint32_t dc)
 {
-	double minErr = 1e99;
-	double curErr;
-	uint32_t hi = 0;
-	uint32_t lo = maxSpan;
-	uint32_t bestSingleBitWidth = 0;
+	uint64_t sum = 0;
 
-	// Get hi and lo
-	for (uint32_t i = 0; i < maxSpan; i++)
-	{
-		if (spans[i] != 0)
-		{
-			lo = i;
-			break;
-		}
-	}
-	for (uint32_t i = maxSpan; i > lo; i--)
+	for (uint32_t i = 0; i < count; i++)
 	{
-		if (spans[i] != 0)
-		{
-			hi = i;
-			break;
-		}
+		sum += samples[i];
+		samples[i] = std::max(samples[i], dc) - std::min(samples[i], dc);
 	}
-	if (lo > hi)
+	return sum;
+}
+
+/**
+ * Frequency discriminator. The phase step between neighboring complex samples is the angle of
+ * one times the conjugate of the other, its sine is the cross product over the magnitudes.
+ *
+ * @param freq  - Receives the sine of the phase step from sample i to i + 1
+ * @param re    - Real parts (count + 1 samples)
+ * @param im    - Imaginary parts (count + 1 samples)
+ * @param count - Number of phase steps
+ */
+static inline __attribute__((always_inline)) void discriminateSamplesBody(float *freq, const float *re, const float *im, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
 	{
-		return 0;
-	}
+		float cross = re[i] * im[i + 1] - im[i] * re[i + 1];
+		float dot   = re[i] * re[i + 1] + im[i] * im[i + 1];
 
-	// min 10 samples/bit
-	// max 256 bits without change
-	uint32_t endAt = hi / 256;
-	if (endAt < 10)
-	{
-		endAt = 10;
+		// The tiny bias keeps silence at 0 instead of 0/0
+		freq[i] = cross / (sqrtf(cross * cross + dot * dot) + 1e-30f);
 	}
+}
 
-	// Brute force... meh
-	for (uint32_t i = hi; i >= endAt; i--)
+void convertSamplesGeneric(uint32_t *samples, const uint8_t *raw, uint32_t count, uint32_t fileFormat)
+{
+	convertSamplesBody(samples, raw, count, fileFormat);
+}
+
+void countSamplesGeneric(uint32_t *counts, const uint32_t *samples, uint32_t count)
+{
+	countSamplesBody(counts, samples, count);
+}
+
+void thresholdSamplesGeneric(uint64_t *bits, const uint32_t *samples, uint32_t count, uint32_t onOffThreshold)
+{
+	thresholdSamplesBody(bits, samples, count, onOffThreshold);
+}
+
+uint32_t getRunLengthGeneric(const uint64_t *bits, uint32_t pos, uint32_t count)
+{
+	return getRunLengthBody(bits, pos, count);
+}
+
+void formatHexGeneric(char *out, const uint64_t *words, uint64_t numWords)
+{
+	formatHexBody(out, words, numWords);
+}
+
+void mixSamplesGeneric(float *re, float *im, const float *oscRe, const float *oscIm, uint32_t count)
+{
+	mixSamplesBody(re, im, oscRe, oscIm, count);
+}
+
+uint64_t rectifySamplesGeneric(uint32_t *samples, uint32_t count, uint32_t dc)
+{
+	return rectifySamplesBody(samples, count, dc);
+}
+
+void discriminateSamplesGeneric(float *freq, const float *re, const float *im, uint32_t count)
+{
+	discriminateSamplesBody(freq, re, im, count);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// SSE4.2: The generic loops compiled for SSE4.2 and 4 samples at a time thresholds
+
+__attribute__((target("sse4.2"))) void convertSamplesSse4(uint32_t *samples, const uint8_t *raw, uint32_t count, uint32_t fileFormat)
+{
+	convertSamplesBody(samples, raw, count, fileFormat);
+}
+
+__attribute__((target("sse4.2"))) void countSamplesSse4(uint32_t *counts, const uint32_t *samples, uint32_t count)
+{
+	countSamplesBody(counts, samples, count);
+}
+
+__attribute__((target("sse4.2"))) void thresholdSamplesSse4(uint64_t *bits, const uint32_t *samples, uint32_t count, uint32_t onOffThreshold)
+{
+	__m128i  threshold = _mm_set1_epi32((int) onOffThreshold);
+	uint32_t i = 0;
+
+	for (; i + 64 <= count; i += 64)
 	{
-		curErr = 0;
-		for (uint32_t j = lo; j < hi; j++)
-		{
-			if (spans[j] != 0)
-			{
-				uint32_t error;
-				double scaledError;
+		uint64_t word = 0;
 
-				error = j % i;
-				if (error > i - error)
-				{
-					error = i - error;
-				}
-				scaledError = (double) error / i;
-				curErr += scaledError * scaledError * spans[j];
-			}
-		}
-		if (minErr > curErr)
+		for (uint32_t j = 0; j < 64; j += 4)
 		{
-			bestSingleBitWidth = i;
-			minErr = curErr;
+			__m128i sample = _mm_loadu_si128((const __m128i*) (samples + i + j));
+			__m128i on     = _mm_cmpeq_epi32(_mm_max_epu32(sample, threshold), sample);
+
+			word |= ((uint64_t) _mm_movemask_ps(_mm_castsi128_ps(on))) << j;
 		}
+		bits[i / 64] = word;
 	}
-	return bestSingleBitWidth;
+	thresholdSamplesBody(bits + i / 64, samples + i, count - i, onOffThreshold);
 }
 
-/**
- * Outputs the data.
- *
- * @param singleBitWidth - The width of a single bit in number of samples
- * @param onOffThreshold - The threshold value between on and off
- * @param fin            - The input file at the offset of where the data starts
- * @param fileFormat     - The file format
- * @return The bit length of the data or UINT32_MAX on error
- */
-uint32_t printMessage(uint32_t singleBitWidth, uint32_t onOffThreshold, FILE *fin, uint32_t fileFormat)
+__attribute__((target("sse4.2"))) uint32_t getRunLengthSse4(const uint64_t *bits, uint32_t pos, uint32_t count)
+{
+	return getRunLengthBody(bits, pos, count);
+}
+
+__attribute__((target("sse4.2"))) void formatHexSse4(char *out, const uint64_t *words, uint64_t numWords)
 {
-	uint32_t bitLength = 0;
-	uint32_t leftOver;
-	uint32_t samples;
-	uint32_t bits;
-	uint32_t state = 0; // 0 = off, 1 = on
-	uint8_t  currentByte = 0;
+	formatHexBody(out, words, numWords);
+}
+
+__attribute__((target("sse4.2"))) void mixSamplesSse4(float *re, float *im, const float *oscRe, const float *oscIm, uint32_t count)
+{
+	uint32_t i = 0;
 
-	leftOver = ignoreFirstSpan(state, RADIO_FLICKER, onOffThreshold, fin, fileFormat);
-	if (leftOver == UINT32_MAX)
+	for (; i + 4 <= count; i += 4)
 	{
-		return UINT32_MAX;
+		__m128 a = _mm_loadu_ps(re + i);
+		__m128 b = _mm_loadu_ps(im + i);
+		__m128 c = _mm_loadu_ps(oscRe + i);
+		__m128 d = _mm_loadu_ps(oscIm + i);
+
+		_mm_storeu_ps(re + i, _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d)));
+		_mm_storeu_ps(im + i, _mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c)));
 	}
+	mixSamplesBody(re + i, im + i, oscRe + i, oscIm + i, count - i);
+}
 
-	while (1)
+__attribute__((target("sse4.2"))) uint64_t rectifySamplesSse4(uint32_t *samples, uint32_t count, uint32_t dc)
+{
+	return rectifySamplesBody(samples, count, dc);
+}
+
+__attribute__((target("sse4.2"))) void discriminateSamplesSse4(float *freq, const float *re, const float *im, uint32_t count)
+{
+	__m128   bias = _mm_set1_ps(1e-30f);
+	uint32_t i    = 0;
+
+	for (; i + 4 <= count; i += 4)
 	{
-		samples = getNextSpan(state, RADIO_FLICKER, onOffThreshold, fin, fileFormat, leftOver);
-		if (samples == UINT32_MAX)
-		{
-			return UINT32_MAX;
-		}
-		if (samples == 0)
-		{
-			break; // EOF
-		}
+		__m128 a     = _mm_loadu_ps(re + i);
+		__m128 b     = _mm_loadu_ps(im + i);
+		__m128 c     = _mm_loadu_ps(re + i + 1);
+		__m128 d     = _mm_loadu_ps(im + i + 1);
+		__m128 cross = _mm_sub_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c));
+		__m128 dot   = _mm_add_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d));
+		__m128 mag   = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(cross, cross), _mm_mul_ps(dot, dot)));
 
-		// Round to the nearest number of bits
-		bits = (samples + singleBitWidth / 2) / singleBitWidth;
+		_mm_storeu_ps(freq + i, _mm_div_ps(cross, _mm_add_ps(mag, bias)));
+	}
+	discriminateSamplesBody(freq + i, re + i, im + i, count - i);
+}
 
-		uint32_t left = 8 - bitLength % 8;
-		bitLength += bits;
-		if (state == 0) // off
-		{
-			if (left <= bits)
-			{
-				printf("%02x", currentByte);
-				currentByte = 0;
+// AVX2: 8 samples at a time thresholds and skips 256 samples at a time in runs
 
-				// full bytes
-				uint32_t fullBytes = (bits - left) / 8;
-				for (uint32_t i = 0; i < fullBytes; i++)
-				{
-					printf("00");
-				}
-			}
-		}
-		else // on
+__attribute__((target("avx2"))) void convertSamplesAvx2(uint32_t *samples, const uint8_t *raw, uint32_t count, uint32_t fileFormat)
+{
+	convertSamplesBody(samples, raw, count, fileFormat);
+}
+
+__attribute__((target("avx2"))) void countSamplesAvx2(uint32_t *counts, const uint32_t *samples, uint32_t count)
+{
+	countSamplesBody(counts, samples, count);
+}
+
+__attribute__((target("avx2"))) void thresholdSamplesAvx2(uint64_t *bits, const uint32_t *samples, uint32_t count, uint32_t onOffThreshold)
+{
+	__m256i  threshold = _mm256_set1_epi32((int) onOffThreshold);
+	uint32_t i = 0;
+
+	for (; i + 64 <= count; i += 64)
+	{
+		uint64_t word = 0;
+
+		for (uint32_t j = 0; j < 64; j += 8)
 		{
-			if (left <= bits)
-			{
-				currentByte |= (1 << left) - 1;
-				printf("%02x", currentByte);
-				currentByte = 0;
+			__m256i sample = _mm256_loadu_si256((const __m256i*) (samples + i + j));
+			__m256i on     = _mm256_cmpeq_epi32(_mm256_max_epu32(sample, threshold), sample);
 
-				// full bytes
-				uint32_t fullBytes = (bits - left) / 8;
-				for (uint32_t i = 0; i < fullBytes; i++)
-				{
-					printf("ff");
-				}
-				bits -= 8 * fullBytes + left;
-				left = 8;
-			}
-			// extra
-			currentByte |= (1 << left) - (1 << (left - bits));
+			word |= ((uint64_t) (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(on))) << j;
 		}
+		bits[i / 64] = word;
 	}
-	if (bitLength % 8 != 0)
+	thresholdSamplesBody(bits + i / 64, samples + i, count - i, onOffThreshold);
+}
+
+__attribute__((target("avx2"))) uint32_t getRunLengthAvx2(const uint64_t *bits, uint32_t pos, uint32_t count)
+{
+	uint32_t start = pos;
+	uint64_t same  = 0 - ((bits[pos / 64] >> (pos % 64)) & 1);
+
+	// Rest of the first word
+	pos = findChangeBody(bits, pos, std::min(count, pos + 64 - pos % 64), same);
+	if (pos % 64 != 0 || pos == count)
 	{
-		printf("%02x", currentByte);
+		return pos - start;
 	}
-	printf("\n");
-	return bitLength;
+
+	__m256i sameWords = _mm256_set1_epi64x((long long) same);
+
+	while (pos + 256 <= count)
+	{
+		__m256i  words   = _mm256_loadu_si256((const __m256i*) (bits + pos / 64));
+		uint32_t changed = ~(uint32_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(words, sameWords))) & 15;
+
+		if (changed != 0)
+		{
+			pos += 64 * __builtin_ctz(changed);
+			break;
+		}
+		pos += 256;
+	}
+	return findChangeBody(bits, pos, count, same) - start;
 }
 
-int main(int argc, char *argv[])
+__attribute__((target("avx2"))) void formatHexAvx2(char *out, const uint64_t *words, uint64_t numWords)
 {
-	uint32_t  *counts;
-	uint32_t  *spans  = new uint32_t[MAX_SPAN + 1];
-	FILE      *fin;
-	wavHeader  header;
-	uint32_t   startOffset = 0;
-	uint32_t   fileSize;
-	uint32_t   count;
-	uint32_t   bitLength;
-	uint32_t   singleBitWidth;
-	// 16 bits/sample, 1 channel, signed integers, little endian
-	uint32_t   fileFormat = makeFileFormat(2, 1, 0, 1, 1);
-	uint32_t   onOffThreshold;
+	formatHexBody(out, words, numWords);
+}
+
+__attribute__((target("avx2"))) void mixSamplesAvx2(float *re, float *im, const float *oscRe, const float *oscIm, uint32_t count)
+{
+	uint32_t i = 0;
 
-	if (argc != 2)
+	for (; i + 8 <= count; i += 8)
 	{
-		fprintf(stderr, "usage:\n\"%s\" file-name\n", argv[0]);
-		return 1;
+		__m256 a = _mm256_loadu_ps(re + i);
+		__m256 b = _mm256_loadu_ps(im + i);
+		__m256 c = _mm256_loadu_ps(oscRe + i);
+		__m256 d = _mm256_loadu_ps(oscIm + i);
+
+		_mm256_storeu_ps(re + i, _mm256_sub_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, d)));
+		_mm256_storeu_ps(im + i, _mm256_add_ps(_mm256_mul_ps(a, d), _mm256_mul_ps(b, c)));
 	}
+	mixSamplesBody(re + i, im + i, oscRe + i, oscIm + i, count - i);
+}
 
-	// Open wav
-	fin = fopen(argv[1], "rb");
-	if (fin == NULL)
+__attribute__((target("avx2"))) uint64_t rectifySamplesAvx2(uint32_t *samples, uint32_t count, uint32_t dc)
+{
+	__m256i  level     = _mm256_set1_epi32((int) dc);
+	__m256i  lowHalves = _mm256_set1_epi64x(0xffffffff);
+	__m256i  sums      = _mm256_setzero_si256();
+	uint64_t lanes[4];
+	uint32_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
 	{
-		perror("fopen");
-		return 1;
+		__m256i sample = _mm256_loadu_si256((const __m256i*) (samples + i));
+
+		// Even and odd samples are summed in 64 bit lanes
+		sums = _mm256_add_epi64(sums, _mm256_and_si256(sample, lowHalves));
+		sums = _mm256_add_epi64(sums, _mm256_srli_epi64(sample, 32));
+		_mm256_storeu_si256((__m256i*) (samples + i), _mm256_sub_epi32(_mm256_max_epu32(sample, level), _mm256_min_epu32(sample, level)));
 	}
+	_mm256_storeu_si256((__m256i*) lanes, sums);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + rectifySamplesBody(samples + i, count - i, dc);
+}
 
-	// File size
-    fseek(fin, 0, SEEK_END);
-    fileSize = ftell(fin);
-    fseek(fin, 0, SEEK_SET);
+__attribute__((target("avx2"))) void discriminateSamplesAvx2(float *freq, const float *re, const float *im, uint32_t count)
+{
+	__m256   bias = _mm256_set1_ps(1e-30f);
+	uint32_t i    = 0;
 
-	// Read wav header
-	if (fileSize >= 44)
+	for (; i + 8 <= count; i += 8)
 	{
-		if (fread(&header, sizeof(wavHeader), 1, fin) != 1)
-		{
-			perror("fread");
-			return 1;
-		}
+		__m256 a     = _mm256_loadu_ps(re + i);
+		__m256 b     = _mm256_loadu_ps(im + i);
+		__m256 c     = _mm256_loadu_ps(re + i + 1);
+		__m256 d     = _mm256_loadu_ps(im + i + 1);
+		__m256 cross = _mm256_sub_ps(_mm256_mul_ps(a, d), _mm256_mul_ps(b, c));
+		__m256 dot   = _mm256_add_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, d));
+		__m256 mag   = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(cross, cross), _mm256_mul_ps(dot, dot)));
 
-		if (header.tag           == 0x46464952   && // "RIFF"
-		    header.fileSize      == fileSize - 8 &&
-		    header.type          == 0x45564157   && // "WAVE"
-		    header.chunkMarker   == 0x20746d66   && // "fmt "
-		    header.fileSizeSoFar ==         16   &&
-		    header.format        ==          1   && // PCM
-		    header.dataTag       == 0x61746164   && // "data"
-		    header.dataSize      == fileSize - 44)
-		{
-			if (header.channels          ==   0 ||
-			    header.channels          >  256 ||
-			    header.bitsPerSample % 8 !=   0 ||
-				header.bitsPerSample     ==   0 ||
-				header.bitsPerSample     >   32)
-			{
-				fprintf(stderr, "Error: Only supports raw 16 bit signed data and 8, 16, 24, 32 bit .wav with <257 channels\n");
-				return 1;
-			}
-			else
-			{
-				printf("File is a .wav\n");
-				startOffset = 44;
-				fileFormat = makeFileFormat(header.bitsPerSample / 8, header.channels, 0, 1, 1);
-			}
-		}
-		else
-		{
-			printf("Assuming file is raw 16 bit signed data\n");
-			fseek(fin, 0, SEEK_SET);
-		}
+		_mm256_storeu_ps(freq + i, _mm256_div_ps(cross, _mm256_add_ps(mag, bias)));
 	}
-	if (startOffset == 0)
+	discriminateSamplesBody(freq + i, re + i, im + i, count - i);
+}
+
+// AVX-512: 16 samples at a time thresholds and skips 512 samples at a time in runs. BMI2 pdep
+// spreads nibbles for hex (pdep is microcoded on AMD before Zen 3 so the AVX2 kernels don't use it)
+
+__attribute__((target("avx512f,avx512bw"))) void convertSamplesAvx512(uint32_t *samples, const uint8_t *raw, uint32_t count, uint32_t fileFormat)
+{
+	convertSamplesBody(samples, raw, count, fileFormat);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void countSamplesAvx512(uint32_t *counts, const uint32_t *samples, uint32_t count)
+{
+	countSamplesBody(counts, samples, count);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void thresholdSamplesAvx512(uint64_t *bits, const uint32_t *samples, uint32_t count, uint32_t onOffThreshold)
+{
+	__m512i  threshold = _mm512_set1_epi32((int) onOffThreshold);
+	uint32_t i = 0;
+
+	for (; i + 64 <= count; i += 64)
 	{
-		if (fileSize % 2 == 1)
+		uint64_t word = 0;
+
+		for (uint32_t j = 0; j < 64; j += 16)
 		{
-			fprintf(stderr, "Error: Only supports raw 16 bit signed data and 8, 16, 24, 32 bit .wav with <257 channels\n");
-			return 1;
+			__m512i sample = _mm512_loadu_si512((const void*) (samples + i + j));
+
+			word |= ((uint64_t) _mm512_cmpge_epu32_mask(sample, threshold)) << j;
 		}
+		bits[i / 64] = word;
 	}
+	thresholdSamplesBody(bits + i / 64, samples + i, count - i, onOffThreshold);
+}
 
-	size_t numCounts = ((size_t) 1) << (8 * getSampleByteSize(fileFormat));
-	// Check for size overflow
-	if (numCounts == 0)
+__attribute__((target("avx512f,avx512bw"))) uint32_t getRunLengthAvx512(const uint64_t *bits, uint32_t pos, uint32_t count)
+{
+	uint32_t start = pos;
+	uint64_t same  = 0 - ((bits[pos / 64] >> (pos % 64)) & 1);
+
+	// Rest of the first word
+	pos = findChangeBody(bits, pos, std::min(count, pos + 64 - pos % 64), same);
+	if (pos % 64 != 0 || pos == count)
 	{
-		fprintf(stderr, "Error: 32 bit samples requires a 64 bit binary and 16 GiB of RAM.\n");
-		return 1;
+		return pos - start;
 	}
-	counts = new uint32_t[numCounts];
 
-	// Count samples
-	printf("Counting...\n");
-	count = getCounts(counts, fin, fileFormat);
-	if (count == UINT32_MAX)
+	__m512i sameWords = _mm512_set1_epi64((long long) same);
+
+	while (pos + 512 <= count)
 	{
-		return 1;
+		__m512i  words   = _mm512_loadu_si512((const void*) (bits + pos / 64));
+		uint32_t changed = _mm512_cmpneq_epu64_mask(words, sameWords);
+
+		if (changed != 0)
+		{
+			pos += 64 * __builtin_ctz(changed);
+			break;
+		}
+		pos += 512;
 	}
-	fseek(fin, startOffset, SEEK_SET);
+	return findChangeBody(bits, pos, count, same) - start;
+}
 
-	// Finding on off ranges
-	printf("Finding on off ranges...\n");
-	onOffThreshold = findOnOffThreshold(counts, count, fileFormat);
-	if (onOffThreshold == 0)
+__attribute__((target("avx512f,avx512bw,bmi2"))) void formatHexAvx512(char *out, const uint64_t *words, uint64_t numWords)
+{
+	for (uint64_t i = 0; i < 2 * numWords; i++)
 	{
-		fprintf(stderr, "Error: Can't find on off ranges\n");
-		return 1;
+		uint32_t x = (uint32_t) (words[i / 2] >> (32 - 32 * (i % 2)));
+
+		storeHexDigits(out + 8 * i, _pdep_u64(x, 0x0f0f0f0f0f0f0f0f));
 	}
+}
 
-	// Getting spans
-	printf("Getting spans...\n");
-	uint32_t realMaxSpan = getSpans(spans, MAX_SPAN, onOffThreshold, fin, fileFormat);
-	if (realMaxSpan == UINT32_MAX)
+__attribute__((target("avx512f,avx512bw"))) void mixSamplesAvx512(float *re, float *im, const float *oscRe, const float *oscIm, uint32_t count)
+{
+	uint32_t i = 0;
+
+	for (; i + 16 <= count; i += 16)
 	{
-		fprintf(stderr, "Error: 1\n");
-		return 1;
+		__m512 a = _mm512_loadu_ps(re + i);
+		__m512 b = _mm512_loadu_ps(im + i);
+		__m512 c = _mm512_loadu_ps(oscRe + i);
+		__m512 d = _mm512_loadu_ps(oscIm + i);
+
+		_mm512_storeu_ps(re + i, _mm512_sub_ps(_mm512_mul_ps(a, c), _mm512_mul_ps(b, d)));
+		_mm512_storeu_ps(im + i, _mm512_add_ps(_mm512_mul_ps(a, d), _mm512_mul_ps(b, c)));
 	}
-	fseek(fin, startOffset, SEEK_SET);
+	mixSamplesBody(re + i, im + i, oscRe + i, oscIm + i, count - i);
+}
 
-	// Finding single bit width
-	printf("Finding single bit width...\n");
-	singleBitWidth = findSingleBitWidth(spans, realMaxSpan);
-	if (singleBitWidth == 0)
+__attribute__((target("avx512f,avx512bw"))) uint64_t rectifySamplesAvx512(uint32_t *samples, uint32_t count, uint32_t dc)
+{
+	__m512i  level     = _mm512_set1_epi32((int) dc);
+	__m512i  lowHalves = _mm512_set1_epi64(0xffffffff);
+	__m512i  sums      = _mm512_setzero_si512();
+	uint64_t lanes[8];
+	uint32_t i = 0;
+
+	for (; i + 16 <= count; i += 16)
 	{
-		fprintf(stderr, "Error: 2\n");
-		return 1;
+		__m512i sample = _mm512_loadu_si512((const void*) (samples + i));
+
+		// The maskz forms avoid GCC 12's false -Wmaybe-uninitialized in the unmasked ones. Even and
+		// odd samples are summed in 64 bit lanes.
+		sums = _mm512_maskz_add_epi64(0xff, sums, _mm512_and_si512(sample, lowHalves));
+		sums = _mm512_maskz_add_epi64(0xff, sums, _mm512_maskz_srli_epi64(0xff, sample, 32));
+		_mm512_storeu_si512((void*) (samples + i), _mm512_maskz_sub_epi32(0xffff, _mm512_maskz_max_epu32(0xffff, sample, level), _mm512_maskz_min_epu32(0xffff, sample, level)));
 	}
+	_mm512_storeu_si512((void*) lanes, sums);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7] + rectifySamplesBody(samples + i, count - i, dc);
+}
 
-	// Print bit width
-	printf("samples/bit: %u\n", singleBitWidth);
-	if (startOffset != 0) // .wav
+__attribute__((target("avx512f,avx512bw"))) void discriminateSamplesAvx512(float *freq, const float *re, const float *im, uint32_t count)
+{
+	__m512   bias = _mm512_set1_ps(1e-30f);
+	uint32_t i    = 0;
+
+	for (; i + 16 <= count; i += 16)
 	{
-		printf("seconds/bit: %0.9f\n", (double) singleBitWidth / header.sampleRate);
-		printf("bits/second: %0.3f\n", (double) header.sampleRate / singleBitWidth);
+		__m512 a     = _mm512_loadu_ps(re + i);
+		__m512 b     = _mm512_loadu_ps(im + i);
+		__m512 c     = _mm512_loadu_ps(re + i + 1);
+		__m512 d     = _mm512_loadu_ps(im + i + 1);
+		__m512 cross = _mm512_sub_ps(_mm512_mul_ps(a, d), _mm512_mul_ps(b, c));
+		__m512 dot   = _mm512_add_ps(_mm512_mul_ps(a, c), _mm512_mul_ps(b, d));
+		// The maskz sqrt avoids GCC 12's false -Wmaybe-uninitialized in the unmasked one
+		__m512 mag   = _mm512_maskz_sqrt_ps(0xffff, _mm512_add_ps(_mm512_mul_ps(cross, cross), _mm512_mul_ps(dot, dot)));
+
+		_mm512_storeu_ps(freq + i, _mm512_div_ps(cross, _mm512_add_ps(mag, bias)));
 	}
+	discriminateSamplesBody(freq + i, re + i, im + i, count - i);
+}
+#endif
 
-	// Print message
-	bitLength = printMessage(singleBitWidth, onOffThreshold, fin, fileFormat);
-	if (bitLength == UINT32_MAX)
+/**
+ * The kernels for the hot loops at one instruction set level.
+ */
+struct kernelSet
+{
+	const char *name;
+	void      (*convertSamples)(uint32_t *samples, const uint8_t *raw, uint32_t count, uint32_t fileFormat);
+	void      (*countSamples)(uint32_t *counts, const uint32_t *samples, uint32_t count);
+	void      (*thresholdSamples)(uint64_t *bits, const uint32_t *samples, uint32_t count, uint32_t onOffThreshold);
+	uint32_t  (*getRunLength)(const uint64_t *bits, uint32_t pos, uint32_t count);
+	void      (*formatHex)(char *out, const uint64_t *words, uint64_t numWords);
+	void      (*mixSamples)(float *re, float *im, const float *oscRe, const float *oscIm, uint32_t count);
+	uint64_t  (*rectifySamples)(uint32_t *samples, uint32_t count, uint32_t dc);
+	void      (*discriminateSamples)(float *freq, const float *re, const float *im, uint32_t count);
+	uint32_t    supported; // Set by selectKernels()
+};
+
+// Best first
+kernelSet kernelSets[] =
+{
+#if defined(__x86_64__) || defined(__i386__)
+	{"avx512",  convertSamplesAvx512,  countSamplesAvx512,  thresholdSamplesAvx512,  getRunLengthAvx512,  formatHexAvx512,  mixSamplesAvx512,  rectifySamplesAvx512,  discriminateSamplesAvx512,  0},
+	{"avx2",    convertSamplesAvx2,    countSamplesAvx2,    thresholdSamplesAvx2,    getRunLengthAvx2,    formatHexAvx2,    mixSamplesAvx2,    rectifySamplesAvx2,    discriminateSamplesAvx2,    0},
+	{"sse4",    convertSamplesSse4,    countSamplesSse4,    thresholdSamplesSse4,    getRunLengthSse4,    formatHexSse4,    mixSamplesSse4,    rectifySamplesSse4,    discriminateSamplesSse4,    0},
+#endif
+	{"generic", convertSamplesGeneric, countSamplesGeneric, thresholdSamplesGeneric, getRunLengthGeneric, formatHexGeneric, mixSamplesGeneric, rectifySamplesGeneric, discriminateSamplesGeneric, 1}
+};
+
+// The selected kernels
+kernelSet kernels = kernelSets[sizeof(kernelSets) / sizeof(kernelSet) - 1];
+
+/**
+ * Selects the kernels to use. This checks what the CPU supports with cpuid.
+ *
+ * @param name - Name of the kernels to use or NULL for the best the CPU supports
+ * @return 0 on success, non-zero if name is unknown or the CPU doesn't support it
+ */
+uint32_t selectKernels(const char *name)
+{
+	uint32_t numKernelSets = sizeof(kernelSets) / sizeof(kernelSet);
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	kernelSets[0].supported = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2");
+	kernelSets[1].supported = __builtin_cpu_supports("avx2");
+	kernelSets[2].supported = __builtin_cpu_supports("sse4.2");
+#endif
+	for (uint32_t i = 0; i < numKernelSets; i++)
 	{
-		fprintf(stderr, "Error: Durp?\n");
-		return 1;
+		if (name == NULL ? kernelSets[i].supported : strcmp(name, kernelSets[i].name) == 0)
+		{
+			if (!kernelSets[i].supported)
+			{
+				fprintf(stderr, "Error: This CPU doesn't support %s\n", name);
+				return 1;
+			}
+			kernels = kernelSets[i];
+			return 0;
+		}
 	}
-	return 0;
+	fprintf(stderr, "Error: Unknown kernels \"%s\"\n", name);
+	return 1;
+}
+
+/**
+ * Reads a frame (a sample from every channel) from the input file.
+ *
+ * @param samples    - Receives one value per channel
+ * @param fin        - The input file at an offset into the data
+ * @param fileFormat - The file format
+ * @return 0 on success, non-zero on error or EOF
+ */
+uint32_t getFrame(uint32_t *samples, FILE *fin, uint32_t fileFormat)
+{
+	uint32_t sampleSize = ( fileFormat        &    3) + 1;
+	uint32_t channels   = ((fileFormat >>  2) & 0xff) + 1;
+	uint8_t  frame8[4 * 256];
+
+	if (fread(frame8, sampleSize * channels, 1, fin) != 1)
+	{
+		if (!feof(fin))
+		{
+			perror("fread");
+		}
+		return 1;
+	}
+	for (uint32_t i = 0; i < channels; i++)
+	{
+		samples[i] = decodeSample(frame8 + sampleSize * i, fileFormat);
+	}
+	return 0;
+}
+
+/**
+ * State of rectify() between blocks.
+ */
+struct rectifier
+{
+	uint32_t  window;                    // Length of the low pass filter
+	uint32_t  center;                    // The 0 level of the samples
+	uint64_t  groups[RECTIFY_DC_GROUPS]; // Sums of the last groups of RECTIFY_GROUP samples
+	uint64_t  groupsSum;                 // Sum of groups
+	uint32_t  oldestGroup;
+	uint64_t  groupSum;                  // Sum of the current group so far
+	uint32_t  groupCount;                // Number of samples in the current group so far
+	uint32_t *history;                   // The last window rectified samples
+	uint64_t  historySum;                // Sum of history
+	uint32_t  oldestHistory;
+};
+
+/**
+ * Sets a rectifier back to its starting state. The DC level starts at the center of the sample
+ * range.
+ *
+ * @param rect - The rectifier
+ */
+void resetRectifier(rectifier &rect)
+{
+	for (uint32_t i = 0; i < RECTIFY_DC_GROUPS; i++)
+	{
+		rect.groups[i] = (uint64_t) rect.center * RECTIFY_GROUP;
+	}
+	rect.groupsSum     = (uint64_t) rect.center * RECTIFY_GROUP * RECTIFY_DC_GROUPS;
+	rect.oldestGroup   = 0;
+	rect.groupSum      = 0;
+	rect.groupCount    = 0;
+	rect.historySum    = 0;
+	rect.oldestHistory = 0;
+	for (uint32_t i = 0; i < rect.window; i++)
+	{
+		rect.history[i] = 0;
+	}
+}
+
+/**
+ * Makes the state for rectify().
+ *
+ * @param window     - Length of the low pass filter
+ * @param fileFormat - The file format
+ * @return The rectifier. Free it with freeRectifier()
+ */
+rectifier *makeRectifier(uint32_t window, uint32_t fileFormat)
+{
+	rectifier *rect = new rectifier;
+
+	rect->window  = window;
+	rect->center  = (uint32_t) (((uint64_t) 1) << (8 * getSampleByteSize(fileFormat) - 1));
+	rect->history = new uint32_t[window];
+	resetRectifier(*rect);
+	return rect;
+}
+
+/**
+ * Frees a rectifier made by makeRectifier().
+ *
+ * @param rect - The rectifier
+ */
+void freeRectifier(rectifier *rect)
+{
+	delete [] rect->history;
+	delete rect;
+}
+
+/**
+ * Turns AC coupled samples (an oscillating "on" state) into an envelope. The DC level is the
+ * average of the last RECTIFY_DC_GROUPS * RECTIFY_GROUP samples, updated after each group, and is
+ * removed by the full-wave rectifying kernel. The low pass filter is a moving average of the last
+ * window samples. A moving max (peak hold) would widen every on span by the window, the average
+ * delays both edges the same.
+ *
+ * @param rect    - The rectifier
+ * @param samples - The samples (replaced by the envelope)
+ * @param count   - Number of samples
+ */
+void rectify(rectifier &rect, uint32_t *samples, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; )
+	{
+		uint32_t n  = std::min(count - i, RECTIFY_GROUP - rect.groupCount);
+		uint32_t dc = (uint32_t) (rect.groupsSum / (RECTIFY_GROUP * RECTIFY_DC_GROUPS));
+
+		rect.groupSum   += kernels.rectifySamples(samples + i, n, dc);
+		rect.groupCount += n;
+		i += n;
+		if (rect.groupCount == RECTIFY_GROUP)
+		{
+			rect.groupsSum += rect.groupSum;
+			rect.groupsSum -= rect.groups[rect.oldestGroup];
+			rect.groups[rect.oldestGroup] = rect.groupSum;
+			rect.oldestGroup = (rect.oldestGroup + 1) % RECTIFY_DC_GROUPS;
+			rect.groupSum    = 0;
+			rect.groupCount  = 0;
+		}
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		rect.historySum += samples[i];
+		rect.historySum -= rect.history[rect.oldestHistory];
+		rect.history[rect.oldestHistory] = samples[i];
+		if (++rect.oldestHistory == rect.window)
+		{
+			rect.oldestHistory = 0;
+		}
+		samples[i] = (uint32_t) (rect.historySum / rect.window);
+	}
+}
+
+/**
+ * Builds an --overview file as samples go by.
+ */
+struct overviewWriter
+{
+	FILE                      *fout;
+	uint32_t                   zero;     // Sample value of silence
+	uint64_t                   numSamples;
+	uint32_t                   min[OVERVIEW_LEVELS];
+	uint32_t                   max[OVERVIEW_LEVELS];
+	double                     sumSquares[OVERVIEW_LEVELS];
+	uint64_t                   count[OVERVIEW_LEVELS]; // Samples in the entry being built
+	std::vector<overviewEntry> levels[OVERVIEW_LEVELS]; // Finished entries except level 0 which goes to fout
+	uint32_t                   error;
+};
+
+/**
+ * Makes an overview writer.
+ *
+ * @param fileName   - The output file name
+ * @param fileFormat - The file format of the samples
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param envelope   - Samples are an envelope (silence is 0) instead of a waveform
+ * @return The overview writer or NULL on error
+ */
+overviewWriter *makeOverviewWriter(const char *fileName, uint32_t fileFormat, uint32_t sampleRate, uint32_t envelope)
+{
+	overviewWriter *writer = new overviewWriter;
+	overviewHeader  header = {OVERVIEW_TAG, OVERVIEW_VERSION, fileFormat, sampleRate, 0, OVERVIEW_LEVELS, OVERVIEW_LEVEL_SHIFT};
+
+	writer->fout = fopen(fileName, "wb");
+	if (writer->fout == NULL)
+	{
+		perror("fopen");
+		delete writer;
+		return NULL;
+	}
+	// Header is written again once the number of samples is known
+	if (fwrite(&header, sizeof(overviewHeader), 1, writer->fout) != 1)
+	{
+		perror("fwrite");
+		fclose(writer->fout);
+		delete writer;
+		return NULL;
+	}
+	writer->zero = 0;
+	if (((fileFormat >> 18) & 1) && !envelope)
+	{
+		writer->zero = ((uint32_t) 1) << (8 * getSampleByteSize(fileFormat) - 1);
+	}
+	writer->numSamples = 0;
+	for (uint32_t i = 0; i < OVERVIEW_LEVELS; i++)
+	{
+		writer->min[i]        = UINT32_MAX;
+		writer->max[i]        = 0;
+		writer->sumSquares[i] = 0;
+		writer->count[i]      = 0;
+	}
+	writer->error = 0;
+	return writer;
+}
+
+/**
+ * Finishes the entry being built at a level and adds it to the next level.
+ *
+ * @param writer - The overview writer
+ * @param level  - The level
+ */
+void finishOverviewEntry(overviewWriter &writer, uint32_t level)
+{
+	overviewEntry entry = {writer.min[level], writer.max[level], writer.sumSquares[level] / writer.count[level]};
+
+	if (level == 0)
+	{
+		if (!writer.error && fwrite(&entry, sizeof(overviewEntry), 1, writer.fout) != 1)
+		{
+			perror("fwrite");
+			writer.error = 1;
+		}
+	}
+	else
+	{
+		writer.levels[level].push_back(entry);
+	}
+	if (level + 1 < OVERVIEW_LEVELS)
+	{
+		writer.min[level + 1]         = std::min(writer.min[level + 1], writer.min[level]);
+		writer.max[level + 1]         = std::max(writer.max[level + 1], writer.max[level]);
+		writer.sumSquares[level + 1] += writer.sumSquares[level];
+		writer.count[level + 1]      += writer.count[level];
+	}
+	writer.min[level]        = UINT32_MAX;
+	writer.max[level]        = 0;
+	writer.sumSquares[level] = 0;
+	writer.count[level]      = 0;
+}
+
+/**
+ * Adds samples to an overview.
+ *
+ * @param writer  - The overview writer
+ * @param samples - The samples
+ * @param count   - Number of samples
+ */
+void addOverview(overviewWriter &writer, const uint32_t *samples, uint32_t count)
+{
+	const uint32_t entrySize = ((uint32_t) 1) << OVERVIEW_LEVEL_SHIFT;
+
+	for (uint32_t i = 0; i < count; )
+	{
+		uint32_t n   = std::min(count - i, entrySize - (uint32_t) writer.count[0]);
+		uint32_t min = writer.min[0];
+		uint32_t max = writer.max[0];
+		double   sumSquares = 0;
+
+		for (uint32_t j = i; j < i + n; j++)
+		{
+			double x = (double) samples[j] - writer.zero;
+
+			min = std::min(min, samples[j]);
+			max = std::max(max, samples[j]);
+			sumSquares += x * x;
+		}
+		writer.min[0]         = min;
+		writer.max[0]         = max;
+		writer.sumSquares[0] += sumSquares;
+		writer.count[0]      += n;
+		writer.numSamples    += n;
+		i += n;
+		for (uint32_t level = 0; level < OVERVIEW_LEVELS && writer.count[level] == ((uint64_t) entrySize) << (OVERVIEW_LEVEL_SHIFT * level); level++)
+		{
+			finishOverviewEntry(writer, level);
+		}
+	}
+}
+
+/**
+ * Writes the partial last entries, the upper levels and the header and frees an overview writer.
+ *
+ * @param writer     - The overview writer
+ * @param fileFormat - The file format of the samples
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @return 0 on success, non-zero on error
+ */
+uint32_t freeOverviewWriter(overviewWriter *writer, uint32_t fileFormat, uint32_t sampleRate)
+{
+	overviewHeader header = {OVERVIEW_TAG, OVERVIEW_VERSION, fileFormat, sampleRate, writer->numSamples, OVERVIEW_LEVELS, OVERVIEW_LEVEL_SHIFT};
+	uint32_t       error;
+
+	for (uint32_t level = 0; level < OVERVIEW_LEVELS; level++)
+	{
+		if (writer->count[level] != 0)
+		{
+			finishOverviewEntry(*writer, level);
+		}
+	}
+	for (uint32_t level = 1; level < OVERVIEW_LEVELS && !writer->error; level++)
+	{
+		size_t numEntries = writer->levels[level].size();
+
+		if (numEntries != 0 && fwrite(writer->levels[level].data(), sizeof(overviewEntry), numEntries, writer->fout) != numEntries)
+		{
+			perror("fwrite");
+			writer->error = 1;
+		}
+	}
+	if (!writer->error && (fseek(writer->fout, 0, SEEK_SET) || fwrite(&header, sizeof(overviewHeader), 1, writer->fout) != 1))
+	{
+		perror("fwrite");
+		writer->error = 1;
+	}
+	if (fclose(writer->fout) && !writer->error)
+	{
+		perror("fclose");
+		writer->error = 1;
+	}
+	error = writer->error;
+	delete writer;
+	return error;
+}
+
+/**
+ * A file of a sample stream that reads files one after another.
+ */
+struct streamFile
+{
+	FILE    *fin;
+	uint64_t startOffset; // Offset of the data in fin
+	uint64_t numSamples;
+};
+
+/**
+ * A source of samples for the demodulator. Either a file, files or a buffer of samples.
+ */
+struct sampleStream
+{
+	FILE           *fin;         // The input file or NULL to read from memory
+	uint32_t        fileFormat;  // The file format (of fin or the values in memory)
+	uint64_t        startOffset; // Offset of the data in fin
+	const uint32_t *memory;      // Samples when fin is NULL
+	uint64_t        memorySize;  // Number of samples in memory
+	uint64_t        position;    // Number of samples read from memory
+	uint32_t        eof;         // Set once there are no more samples
+	rectifier      *rectify;     // Turns samples into an envelope or NULL
+	overviewWriter *overview;    // Filled in by the next pass that counts samples or NULL
+	const streamFile *files;     // Files read one after another (fin is one of them) or NULL
+	uint32_t        numFiles;
+	uint32_t        file;        // Index of fin in files
+	uint32_t        countShift;  // Low bits of samples left out of getCounts()
+	uint64_t        limit;       // Passes stop after this many samples or 0 for all of them
+};
+
+/**
+ * Makes a sample stream that reads from a file.
+ *
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @return The sample stream
+ */
+sampleStream makeFileStream(FILE *fin, uint32_t fileFormat, uint64_t startOffset)
+{
+	sampleStream stream = {fin, fileFormat, startOffset, NULL, 0, 0, 0, NULL, NULL, NULL, 0, 0, 0, 0};
+
+	return stream;
+}
+
+/**
+ * Makes a sample stream that reads from memory.
+ *
+ * @param samples    - The samples
+ * @param numSamples - Number of samples
+ * @param fileFormat - The format the values are limited to (only the sample size is used)
+ * @return The sample stream
+ */
+sampleStream makeMemoryStream(const uint32_t *samples, uint64_t numSamples, uint32_t fileFormat)
+{
+	sampleStream stream = {NULL, fileFormat, 0, samples, numSamples, 0, 0, NULL, NULL, NULL, 0, 0, 0, 0};
+
+	return stream;
+}
+
+/**
+ * Makes a sample stream that reads files one after another as if they were one file. Spans and
+ * everything measured carry across the files.
+ *
+ * @param files      - The files (at least one) which must outlive the stream
+ * @param numFiles   - Number of files
+ * @param fileFormat - The file format of every file
+ * @return The sample stream
+ */
+sampleStream makeFilesStream(const streamFile *files, uint32_t numFiles, uint32_t fileFormat)
+{
+	sampleStream stream = {files[0].fin, fileFormat, files[0].startOffset, NULL, 0, 0, 0, NULL, NULL, files, numFiles, 0, 0, 0};
+
+	return stream;
+}
+
+/**
+ * Moves a sample stream to one of its files.
+ *
+ * @param stream - The sample stream
+ * @param file   - Index of the file
+ */
+void setStreamFile(sampleStream &stream, uint32_t file)
+{
+	stream.file        = file;
+	stream.fin         = stream.files[file].fin;
+	stream.startOffset = stream.files[file].startOffset;
+}
+
+/**
+ * Moves a sample stream back to the first sample.
+ *
+ * @param stream - The sample stream
+ */
+void rewindStream(sampleStream &stream)
+{
+	if (stream.files != NULL)
+	{
+		setStreamFile(stream, 0);
+	}
+	if (stream.fin != NULL)
+	{
+		fseek(stream.fin, (long) stream.startOffset, SEEK_SET);
+	}
+	stream.position = 0;
+	stream.eof = 0;
+	if (stream.rectify != NULL)
+	{
+		resetRectifier(*stream.rectify);
+	}
+}
+
+/**
+ * Moves a sample stream to a sample.
+ *
+ * @param stream - The sample stream
+ * @param sample - The sample number
+ * @return 0 on success, non-zero on error
+ */
+uint32_t seekStream(sampleStream &stream, uint64_t sample)
+{
+	stream.eof = 0;
+	if (stream.rectify != NULL)
+	{
+		resetRectifier(*stream.rectify);
+	}
+	if (stream.files != NULL)
+	{
+		uint32_t file = 0;
+
+		while (file + 1 < stream.numFiles && sample >= stream.files[file].numSamples)
+		{
+			sample -= stream.files[file].numSamples;
+			file++;
+		}
+		setStreamFile(stream, file);
+	}
+	if (stream.fin != NULL)
+	{
+		uint64_t frameSize = (uint64_t) getSampleByteSize(stream.fileFormat) * (((stream.fileFormat >> 2) & 0xff) + 1);
+
+		if (fseek(stream.fin, (long) (stream.startOffset + sample * frameSize), SEEK_SET))
+		{
+			perror("fseek");
+			return 1;
+		}
+		return 0;
+	}
+	stream.position = std::min(sample, stream.memorySize);
+	return 0;
+}
+
+/**
+ * Reads samples from a sample stream.
+ *
+ * @param samples    - Receives up to maxSamples values
+ * @param maxSamples - Max number of samples to read
+ * @param stream     - The sample stream
+ * @param error      - Set to non-zero if there's an error
+ * @return The number of samples read. This is less than maxSamples at the end of the stream or on error
+ */
+uint32_t getSamples(uint32_t *samples, uint32_t maxSamples, sampleStream &stream, uint32_t *error)
+{
+	*error = 0;
+	if (stream.fin == NULL)
+	{
+		uint64_t count = std::min((uint64_t) maxSamples, stream.memorySize - stream.position);
+
+		memcpy(samples, stream.memory + stream.position, (size_t) count * sizeof(uint32_t));
+		stream.position += count;
+		if (count < maxSamples)
+		{
+			stream.eof = 1;
+		}
+		if (stream.rectify != NULL)
+		{
+			rectify(*stream.rectify, samples, (uint32_t) count);
+		}
+		return (uint32_t) count;
+	}
+
+	uint8_t  raw[65536];
+	uint32_t sampleSize = getSampleByteSize(stream.fileFormat);
+	uint32_t frameSize  = sampleSize * (((stream.fileFormat >> 2) & 0xff) + 1);
+	uint32_t count      = 0;
+
+	while (count < maxSamples)
+	{
+		size_t want = std::min((size_t) (maxSamples - count), sizeof(raw) / frameSize);
+		size_t got  = fread(raw, frameSize, want, stream.fin);
+
+		kernels.convertSamples(samples + count, raw, (uint32_t) got, stream.fileFormat);
+		count += (uint32_t) got;
+		if (got < want)
+		{
+			if (ferror(stream.fin))
+			{
+				perror("fread");
+				*error = 1;
+			}
+			else if (stream.files != NULL && stream.file + 1 < stream.numFiles)
+			{
+				// Next file
+				setStreamFile(stream, stream.file + 1);
+				if (fseek(stream.fin, (long) stream.startOffset, SEEK_SET) == 0)
+				{
+					continue;
+				}
+				perror("fseek");
+				*error = 1;
+			}
+			stream.eof = 1;
+			break;
+		}
+	}
+	if (stream.rectify != NULL)
+	{
+		rectify(*stream.rectify, samples, count);
+	}
+	return count;
+}
+
+/**
+ * Time spent in each stage of the pipeline (nanoseconds).
+ */
+struct pipelineStats
+{
+	std::atomic<uint64_t> busy[STAGE_COUNT + 1]; // Each stage then the consumer
+	std::atomic<uint64_t> wall;
+	std::atomic<uint64_t> cacheHits;   // Files output from --cache
+	std::atomic<uint64_t> cacheMisses; // Files decoded and added to --cache
+	std::atomic<uint64_t> largeBytes[LARGE_COUNT][PAGES_COUNT]; // Bytes of each kind of large buffer by backing
+};
+
+pipelineStats stats;
+
+/**
+ * Gets the bytes allocLarge() maps for a buffer.
+ *
+ * @param size - The buffer's size
+ * @return The bytes mapped or 0 if it's from malloc
+ */
+size_t getLargeMapSize(size_t size)
+{
+	if (size < HUGE_PAGE_SIZE / 2)
+	{
+		return 0;
+	}
+	return (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+}
+
+/**
+ * Allocates a large buffer that's touched randomly or streamed heavily. Buffers of at least half
+ * a huge page are mapped with explicit huge pages (MAP_HUGETLB) if any are reserved, otherwise
+ * mapped aligned to a huge page and marked for transparent huge pages, otherwise normal pages.
+ * Smaller buffers are from malloc. Throws std::bad_alloc like new.
+ *
+ * @param size   - The buffer's size
+ * @param buffer - LARGE_COUNTS, LARGE_BLOCKS or LARGE_SAMPLES (for --stats)
+ * @return The buffer, free with freeLarge()
+ */
+void *allocLarge(size_t size, uint32_t buffer)
+{
+	size_t   mapSize = getLargeMapSize(size);
+	uint32_t pages   = PAGES_NORMAL;
+	void    *memory;
+
+	if (mapSize == 0)
+	{
+		memory = malloc(size);
+		if (memory == NULL)
+		{
+			throw std::bad_alloc();
+		}
+	}
+	else
+	{
+		memory = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (memory != MAP_FAILED)
+		{
+			pages = PAGES_EXPLICIT;
+		}
+		else
+		{
+			// Map an extra huge page and trim to an aligned range
+			uint8_t *mapped = (uint8_t*) mmap(NULL, mapSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (mapped == MAP_FAILED)
+			{
+				throw std::bad_alloc();
+			}
+			uint8_t *aligned = (uint8_t*) (((uintptr_t) mapped + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+
+			if (aligned != mapped)
+			{
+				munmap(mapped, aligned - mapped);
+			}
+			munmap(aligned + mapSize, mapped + HUGE_PAGE_SIZE - aligned);
+			memory = aligned;
+			// Only a request, with THP off or "never" the pages stay normal
+			if (madvise(memory, mapSize, MADV_HUGEPAGE) == 0)
+			{
+				pages = PAGES_TRANSPARENT;
+			}
+		}
+	}
+	stats.largeBytes[buffer][pages] += size;
+	return memory;
+}
+
+/**
+ * Frees a buffer from allocLarge().
+ *
+ * @param memory - The buffer
+ * @param size   - The buffer's size
+ */
+void freeLarge(void *memory, size_t size)
+{
+	size_t mapSize = getLargeMapSize(size);
+
+	if (mapSize == 0)
+	{
+		free(memory);
+	}
+	else
+	{
+		munmap(memory, mapSize);
+	}
+}
+
+/**
+ * A run of samples in one state.
+ */
+struct span
+{
+	uint64_t start;  // First sample
+	uint32_t length; // Number of samples
+	uint32_t state;  // 0 = off, 1 = on
+};
+
+/**
+ * A block of samples and what each stage of the pipeline found in them.
+ */
+struct sampleBlock
+{
+	uint64_t  start;    // Index of the first sample in the stream
+	uint32_t  count;    // Number of samples
+	uint32_t  last;     // Non-zero for the last block of the stream
+	uint32_t  error;    // Non-zero if reading failed
+	uint32_t *samples;  // SAMPLE_BLOCK_SIZE samples
+	uint64_t *bits;     // On/off state of each sample (sample i is bit i%64 of bits[i/64])
+	span     *spans;    // Spans that ended in this block
+	uint32_t  numSpans;
+};
+
+/**
+ * Gets the bytes of the buffers of a block.
+ *
+ * @param withSamples - If the block has its own samples, otherwise only the state bits and spans
+ * @return The bytes
+ */
+size_t getBlockSize(uint32_t withSamples)
+{
+	return SAMPLE_BLOCK_SIZE * ((withSamples ? sizeof(uint32_t) : 0) + sizeof(span)) + SAMPLE_BLOCK_SIZE / 8;
+}
+
+/**
+ * Allocates the buffers of blocks from one large buffer.
+ *
+ * @param blocks      - The blocks
+ * @param numBlocks   - Number of blocks
+ * @param withSamples - If the blocks have their own samples, otherwise samples is NULL and the
+ *                      blocks hold the state bits and spans of another block's samples
+ */
+void allocBlocks(sampleBlock *blocks, uint32_t numBlocks, uint32_t withSamples)
+{
+	size_t   blockSize   = getBlockSize(withSamples);
+	size_t   samplesSize = withSamples ? SAMPLE_BLOCK_SIZE * sizeof(uint32_t) : 0;
+	uint8_t *memory      = (uint8_t*) allocLarge(numBlocks * blockSize, LARGE_BLOCKS);
+
+	for (uint32_t i = 0; i < numBlocks; i++)
+	{
+		sampleBlock &block = blocks[i];
+
+		block.start    = 0;
+		block.count    = 0;
+		block.last     = 0;
+		block.error    = 0;
+		block.samples  = withSamples ? (uint32_t*) memory : NULL;
+		block.spans    = (span*) (memory + samplesSize);
+		block.bits     = (uint64_t*) (memory + samplesSize + SAMPLE_BLOCK_SIZE * sizeof(span));
+		block.numSpans = 0;
+		memory += blockSize;
+	}
+}
+
+/**
+ * Frees the buffers of blocks from allocBlocks().
+ *
+ * @param blocks      - The blocks
+ * @param numBlocks   - Number of blocks
+ * @param withSamples - The same as allocBlocks()
+ */
+void freeBlocks(sampleBlock *blocks, uint32_t numBlocks, uint32_t withSamples)
+{
+	freeLarge(withSamples ? (void*) blocks[0].samples : (void*) blocks[0].spans, numBlocks * getBlockSize(withSamples));
+}
+
+/**
+ * State of extractSpans() between blocks.
+ */
+struct spanExtractor
+{
+	uint32_t radioFlicker; // Number samples needed to change the state
+	uint32_t phase;        // 0 = no samples yet, 1 = ignoring the first span, 2 = in a span
+	uint32_t state;        // State of the current span
+	uint32_t count;        // Number of samples in the current span
+	uint32_t nextCount;    // Number of samples in a row not in state
+	uint64_t start;        // First sample of the current span
+	uint64_t nextStart;    // First sample not in state
+};
+
+/**
+ * Makes the state for extractSpans().
+ *
+ * @param radioFlicker - Number samples needed to change the state
+ * @return The span extractor
+ */
+spanExtractor makeSpanExtractor(uint32_t radioFlicker)
+{
+	spanExtractor extractor = {radioFlicker, 0, 0, 0, 0, 0, 0};
+
+	return extractor;
+}
+
+/**
+ * Finds the spans that end in a block. The state changes after more than radioFlicker samples in a
+ * row are in the other state. Shorter flickers are part of the current span. The first span is
+ * ignored since it's the middle of something and the last span is never ended.
+ *
+ * @param extractor - State from the previous block
+ * @param block     - The block (bits are from thresholdSamples()). Receives the spans
+ */
+void extractSpans(spanExtractor &extractor, sampleBlock &block)
+{
+	uint32_t pos = 0;
+
+	block.numSpans = 0;
+	while (pos < block.count)
+	{
+		uint32_t state = (block.bits[pos / 64] >> (pos % 64)) & 1;
+		uint32_t run   = kernels.getRunLength(block.bits, pos, block.count);
+
+		if (extractor.phase == 0)
+		{
+			extractor.phase = 1;
+			extractor.state = state;
+		}
+		else if (state == extractor.state)
+		{
+			// Flicker
+			if (extractor.phase == 2)
+			{
+				extractor.count += extractor.nextCount + run;
+			}
+			extractor.nextCount = 0;
+		}
+		else
+		{
+			if (extractor.nextCount == 0)
+			{
+				extractor.nextStart = block.start + pos;
+			}
+			extractor.nextCount += run;
+			if (extractor.nextCount > extractor.radioFlicker)
+			{
+				if (extractor.phase == 2)
+				{
+					span &out = block.spans[block.numSpans++];
+
+					out.start  = extractor.start;
+					out.length = extractor.count;
+					out.state  = extractor.state;
+				}
+				extractor.phase     = 2;
+				extractor.state     = state;
+				extractor.start     = extractor.nextStart;
+				extractor.count     = extractor.nextCount;
+				extractor.nextCount = 0;
+			}
+		}
+		pos += run;
+	}
+}
+
+/**
+ * Receives each block from runPipeline() in order.
+ *
+ * @param block   - The block
+ * @param context - The context given to runPipeline()
+ * @return 0 to continue, PIPELINE_DONE to stop reading or non-zero on error
+ */
+typedef uint32_t (*blockConsumer)(const sampleBlock &block, void *context);
+
+/**
+ * A bounded queue of blocks between two stages.
+ */
+struct blockQueue
+{
+	std::mutex              lock;
+	std::condition_variable ready;
+	sampleBlock            *blocks[PIPELINE_BLOCKS];
+	uint32_t                first;
+	uint32_t                count;
+};
+
+/**
+ * Adds a block to the end of a queue.
+ *
+ * @param queue - The queue
+ * @param block - The block
+ */
+void pushBlock(blockQueue &queue, sampleBlock *block)
+{
+	std::unique_lock<std::mutex> lock(queue.lock);
+
+	queue.blocks[(queue.first + queue.count) % PIPELINE_BLOCKS] = block;
+	queue.count++;
+	queue.ready.notify_one();
+}
+
+/**
+ * Removes a block from the front of a queue. Waits for one if the queue is empty.
+ *
+ * @param queue - The queue
+ * @return The block
+ */
+sampleBlock *popBlock(blockQueue &queue)
+{
+	std::unique_lock<std::mutex> lock(queue.lock);
+	sampleBlock *block;
+
+	while (queue.count == 0)
+	{
+		queue.ready.wait(lock);
+	}
+	block = queue.blocks[queue.first];
+	queue.first = (queue.first + 1) % PIPELINE_BLOCKS;
+	queue.count--;
+	return block;
+}
+
+/**
+ * The stages and state of one pass over a sample stream.
+ */
+struct pipeline
+{
+	sampleStream  *stream;
+	uint32_t       onOffThreshold;
+	spanExtractor  extractor;
+	uint64_t       nextStart;              // Index of the next sample to read
+	uint32_t       numStages;              // Runs stages 0 to numStages-1
+	blockQueue     queues[STAGE_COUNT + 1]; // Input of each stage then the consumer's input
+	std::atomic<uint32_t> done;            // Set when the consumer stops so reading stops
+};
+
+/**
+ * Runs a stage on a block.
+ *
+ * @param line  - The pipeline
+ * @param stage - The stage
+ * @param block - The block
+ */
+void runStage(pipeline &line, uint32_t stage, sampleBlock &block)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	switch (stage)
+	{
+		case STAGE_READ:
+		{
+			uint64_t limit = line.stream->limit;
+
+			block.start = line.nextStart;
+			if (line.done || (limit != 0 && line.nextStart >= limit))
+			{
+				block.count = 0;
+				block.error = 0;
+				block.last  = 1;
+				break;
+			}
+			block.count = getSamples(block.samples, (uint32_t) std::min((uint64_t) SAMPLE_BLOCK_SIZE, limit != 0 ? limit - line.nextStart : UINT64_MAX), *line.stream, &block.error);
+			block.last  = line.stream->eof | block.error;
+			line.nextStart += block.count;
+			if (limit != 0 && line.nextStart >= limit)
+			{
+				block.last = 1;
+			}
+			break;
+		}
+
+		case STAGE_THRESHOLD:
+			kernels.thresholdSamples(block.bits, block.samples, block.count, line.onOffThreshold);
+			break;
+
+		case STAGE_SPANS:
+			extractSpans(line.extractor, block);
+			break;
+	}
+	stats.busy[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/**
+ * Gives a block to the consumer of a pipeline.
+ *
+ * @param consume - The consumer
+ * @param block   - The block
+ * @param context - Passed to consume
+ * @return The consumer's return value
+ */
+uint32_t runConsumer(blockConsumer consume, const sampleBlock &block, void *context)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	uint32_t ret = consume(block, context);
+
+	stats.busy[STAGE_COUNT] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	return ret;
+}
+
+/**
+ * Runs one stage of a pipeline on its own thread.
+ *
+ * @param line  - The pipeline
+ * @param stage - The stage
+ */
+void runStageThread(pipeline *line, uint32_t stage)
+{
+	while (1)
+	{
+		sampleBlock *block = popBlock(line->queues[stage]);
+
+		if (!block->error)
+		{
+			runStage(*line, stage, *block);
+		}
+		pushBlock(line->queues[stage + 1], block);
+		if (block->last)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * Reads a sample stream in blocks, runs the stages on each block and gives them to a consumer in
+ * order. When pipelined each stage runs on its own thread with bounded queues of blocks between them.
+ *
+ * @param stream         - The sample stream at the start of the data
+ * @param lastStage      - STAGE_READ, STAGE_THRESHOLD or STAGE_SPANS (runs it and the stages before it)
+ * @param onOffThreshold - The threshold value between on and off
+ * @param radioFlicker   - Number samples needed to change the state
+ * @param consume        - Receives each block
+ * @param context        - Passed to consume
+ * @param pipelined      - Run each stage on its own thread
+ * @return 0 on success, non-zero on error
+ */
+uint32_t runPipeline(sampleStream &stream, uint32_t lastStage, uint32_t onOffThreshold, uint32_t radioFlicker, blockConsumer consume, void *context, uint32_t pipelined)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	pipeline    line;
+	sampleBlock blocks[PIPELINE_BLOCKS];
+	uint32_t    numBlocks = 1;
+	uint32_t    error     = 0;
+	uint32_t    stopped   = 0;
+
+	line.stream         = &stream;
+	line.onOffThreshold = onOffThreshold;
+	line.extractor      = makeSpanExtractor(radioFlicker);
+	line.nextStart      = 0;
+	line.numStages      = lastStage + 1;
+	line.done           = 0;
+	for (uint32_t i = 0; i <= STAGE_COUNT; i++)
+	{
+		line.queues[i].first = 0;
+		line.queues[i].count = 0;
+	}
+	if (pipelined)
+	{
+		numBlocks = PIPELINE_BLOCKS;
+	}
+	allocBlocks(blocks, numBlocks, 1);
+
+	if (!pipelined)
+	{
+		sampleBlock &block = blocks[0];
+
+		do
+		{
+			for (uint32_t i = 0; i < line.numStages && !block.error; i++)
+			{
+				runStage(line, i, block);
+			}
+			error = block.error;
+			if (!error)
+			{
+				error = runConsumer(consume, block, context);
+			}
+			if (error == PIPELINE_DONE)
+			{
+				error = 0;
+				break;
+			}
+		} while (!block.last && !error);
+	}
+	else
+	{
+		std::thread threads[STAGE_COUNT];
+		sampleBlock *block;
+
+		for (uint32_t i = 0; i < numBlocks; i++)
+		{
+			pushBlock(line.queues[0], &blocks[i]);
+		}
+		for (uint32_t i = 0; i < line.numStages; i++)
+		{
+			threads[i] = std::thread(runStageThread, &line, i);
+		}
+		do
+		{
+			block = popBlock(line.queues[line.numStages]);
+			if (!error && !stopped)
+			{
+				error = block->error;
+				if (!error)
+				{
+					error = runConsumer(consume, *block, context);
+				}
+				if (error == PIPELINE_DONE)
+				{
+					error = 0;
+					stopped = 1;
+				}
+				if (stopped || error)
+				{
+					// Drain the pipeline
+					stopped = 1;
+					line.done = 1;
+				}
+			}
+			if (!block->last)
+			{
+				pushBlock(line.queues[0], block);
+			}
+		} while (!block->last);
+		for (uint32_t i = 0; i < line.numStages; i++)
+		{
+			threads[i].join();
+		}
+	}
+
+	freeBlocks(blocks, numBlocks, 1);
+	stats.wall += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	return error;
+}
+
+/**
+ * Adds a block of samples to an overview. See main().
+ */
+uint32_t overviewBlock(const sampleBlock &block, void *context)
+{
+	overviewWriter *writer = (overviewWriter*) context;
+
+	addOverview(*writer, block.samples, block.count);
+	return writer->error;
+}
+
+/**
+ * Context of countBlock().
+ */
+struct countContext
+{
+	uint32_t       *counts;
+	uint32_t        count;
+	overviewWriter *overview;
+	uint32_t        shift;    // Low bits of samples left out
+};
+
+/**
+ * Counts samples of each value in a block. See getCounts().
+ */
+uint32_t countBlock(const sampleBlock &block, void *context)
+{
+	countContext *counter = (countContext*) context;
+
+	if (counter->shift == 0)
+	{
+		kernels.countSamples(counter->counts, block.samples, block.count);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < block.count; i++)
+		{
+			counter->counts[block.samples[i] >> counter->shift]++;
+		}
+	}
+	counter->count += block.count;
+	if (counter->overview != NULL)
+	{
+		addOverview(*counter->overview, block.samples, block.count);
+		return counter->overview->error;
+	}
+	return 0;
+}
+
+/**
+ * Gets the number of counts getCounts() fills in.
+ *
+ * @param stream - The sample stream
+ * @return The number of counts
+ */
+size_t getNumCounts(const sampleStream &stream)
+{
+	return ((size_t) 1) << (8 * getSampleByteSize(stream.fileFormat) - stream.countShift);
+}
+
+/**
+ * Counts samples of each value. Samples are counted without their low stream.countShift bits.
+ *
+ * @param counts     - A pointer to integers that receive the number of samples with said value
+ * @param stream     - The sample stream at the start of the data
+ * @param pipelined  - Read on a separate thread
+ * @return The total number of samples or UINT32_MAX on error
+ */
+uint32_t getCounts(uint32_t *counts, sampleStream &stream, uint32_t pipelined)
+{
+	countContext counter = {counts, 0, stream.overview, stream.countShift};
+	size_t       numCounts = getNumCounts(stream);
+
+	for (size_t i = 0; i < numCounts; i++)
+	{
+		counts[i] = 0;
+	}
+	// Only the first pass over all of the samples builds the overview
+	if (stream.limit == 0)
+	{
+		stream.overview = NULL;
+	}
+	else
+	{
+		counter.overview = NULL;
+	}
+	if (runPipeline(stream, STAGE_READ, 0, 0, countBlock, &counter, pipelined))
+	{
+		return UINT32_MAX;
+	}
+	return counter.count;
+}
+
+/**
+ * Finds the range of sample values, ignoring the highest 2% and lowest 2% of samples.
+ *
+ * @param counts     - A constant pointer to integers that were generated from calling getCounts()
+ * @param count      - The total number of samples
+ * @param fileFormat - The file format
+ * @param countShift - Low bits of samples left out of the counts
+ * @param lo         - Receives the lowest value
+ * @param hi         - Receives the highest value
+ * @return 0 on success, non-zero if there isn't a range
+ */
+uint32_t findOnOffRange(const uint32_t *counts, uint32_t count, uint32_t fileFormat, uint32_t countShift, uint32_t *lo, uint32_t *hi)
+{
+	size_t   numCounts = ((size_t) 1) << (8 * getSampleByteSize(fileFormat) - countShift);
+	uint32_t skipCount = count / 50; // 2%
+	uint32_t curCount = 0;
+
+	*hi = 0;
+	*lo = (uint32_t) (numCounts - 1);
+
+	// Get hi and lo
+	for (size_t i = 0; i < numCounts; i++)
+	{
+		if (counts[i] != 0)
+		{
+			curCount += counts[i];
+			if (curCount > skipCount)
+			{
+				*lo = (uint32_t) i;
+				break;
+			}
+		}
+	}
+	curCount = 0;
+	for (uint32_t i = (uint32_t) (numCounts - 1); i > *lo; i--)
+	{
+		if (counts[i] != 0)
+		{
+			curCount += counts[i];
+			if (curCount > skipCount)
+			{
+				*hi = i;
+				break;
+			}
+		}
+	}
+	if (*lo >= *hi)
+	{
+		return 1;
+	}
+
+	// Lowest and highest value of each count
+	*lo <<= countShift;
+	*hi = (*hi << countShift) | ((((uint32_t) 1) << countShift) - 1);
+	return 0;
+}
+
+/**
+ * Finds a threshold value that anything above the value is on and anything below is off.
+ * This is done by averaging the highest sample and lowest sample, ignoring the highest 2% and lowest 2% of samples.
+ * Other levels (--threshold-level) are that far from the lowest to the highest sample.
+ *
+ * @param counts     - A constant pointer to integers that were generated from calling getCounts()
+ * @param count      - The total number of samples
+ * @param fileFormat - The file format
+ * @param countShift - Low bits of samples left out of the counts
+ * @param level      - Where the threshold is from the lowest (0) to the highest (1) sample
+ * @return The threshold value between on and off
+ */
+uint32_t findOnOffThreshold(const uint32_t *counts, uint32_t count, uint32_t fileFormat, uint32_t countShift, double level)
+{
+	uint32_t hi;
+	uint32_t lo;
+
+	if (findOnOffRange(counts, count, fileFormat, countShift, &lo, &hi))
+	{
+		return 0;
+	}
+	return lo + (uint32_t) ((hi - lo) * level);
+}
+
+/**
+ * Context of getSpansBlock().
+ */
+struct spansContext
+{
+	uint32_t *spans;
+	uint32_t  maxSpan;
+	uint32_t  realMaxSpan;
+	uint64_t *bitmap;      // Receives the state bits of the stream or NULL
+};
+
+/**
+ * Counts the spans in a block. See getSpans().
+ */
+uint32_t getSpansBlock(const sampleBlock &block, void *context)
+{
+	spansContext *spanCounter = (spansContext*) context;
+
+	if (spanCounter->bitmap != NULL)
+	{
+		memcpy(spanCounter->bitmap + block.start / 64, block.bits, (block.count + 63) / 64 * sizeof(uint64_t));
+	}
+	for (uint32_t i = 0; i < block.numSpans; i++)
+	{
+		uint32_t count = block.spans[i].length;
+
+		if (spanCounter->realMaxSpan < count)
+		{
+			spanCounter->realMaxSpan = count;
+		}
+		if (count <= spanCounter->maxSpan)
+		{
+			spanCounter->spans[count]++;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Counts spans of samples in either on or off states.
+ *
+ * @param spans          - An array of maxSpan+1 integers
+ * @param maxSpan        - The max span to record
+ * @param onOffThreshold - The threshold value between on and off
+ * @param radioFlicker   - Number samples needed to change the state
+ * @param stream         - The sample stream at the start of the data
+ * @param pipelined      - Run each stage on its own thread
+ * @param bitmap         - Receives the state of each sample (see sampleBlock.bits) or NULL
+ * @return The max span or UINT32_MAX on error
+ */
+uint32_t getSpans(uint32_t *spans, uint32_t maxSpan, uint32_t onOffThreshold, uint32_t radioFlicker, sampleStream &stream, uint32_t pipelined, uint64_t *bitmap)
+{
+	spansContext spanCounter;
+
+	if (maxSpan == UINT32_MAX)
+	{
+		maxSpan = UINT32_MAX - 1;
+	}
+	for (uint32_t i = 0; i <= maxSpan; i++)
+	{
+		spans[i] = 0;
+	}
+	spanCounter.spans       = spans;
+	spanCounter.maxSpan     = maxSpan;
+	spanCounter.realMaxSpan = 0;
+	spanCounter.bitmap      = bitmap;
+	if (runPipeline(stream, STAGE_SPANS, onOffThreshold, radioFlicker, getSpansBlock, &spanCounter, pipelined))
+	{
+		return UINT32_MAX;
+	}
+	return spanCounter.realMaxSpan;
+}
+
+/**
+ * Extracts the spans of the states kept by getSpans() a block at a time like runPipeline().
+ *
+ * @param bitmap       - The state of each sample from getSpans()
+ * @param count        - Number of samples
+ * @param radioFlicker - Number samples needed to change the state
+ * @param consume      - Receives each block with its spans
+ * @param context      - Passed to consume
+ * @return 0 on success, PIPELINE_DONE if consume stopped or non-zero on error
+ */
+uint32_t runBitmapSpans(uint64_t *bitmap, uint64_t count, uint32_t radioFlicker, blockConsumer consume, void *context)
+{
+	spanExtractor extractor = makeSpanExtractor(radioFlicker);
+	sampleBlock   block;
+	uint32_t      ret       = 0;
+
+	block.samples = NULL;
+	block.error   = 0;
+	block.spans   = new span[SAMPLE_BLOCK_SIZE];
+	for (uint64_t start = 0; start < count && ret == 0; start += SAMPLE_BLOCK_SIZE)
+	{
+		block.start = start;
+		block.count = (uint32_t) std::min(count - start, (uint64_t) SAMPLE_BLOCK_SIZE);
+		block.last  = start + block.count == count;
+		block.bits  = bitmap + start / 64;
+		extractSpans(extractor, block);
+		ret = consume(block, context);
+	}
+	delete [] block.spans;
+	return ret;
+}
+
+/**
+ * Counts spans of samples in either on or off states from the states kept by getSpans() instead
+ * of reading the samples again.
+ *
+ * @param spans        - An array of maxSpan+1 integers
+ * @param maxSpan      - The max span to record
+ * @param radioFlicker - Number samples needed to change the state
+ * @param bitmap       - The state of each sample from getSpans()
+ * @param count        - Number of samples
+ * @return The max span
+ */
+uint32_t getBitmapSpans(uint32_t *spans, uint32_t maxSpan, uint32_t radioFlicker, uint64_t *bitmap, uint64_t count)
+{
+	spansContext spanCounter = {spans, maxSpan, 0, NULL};
+
+	for (uint32_t i = 0; i <= maxSpan; i++)
+	{
+		spans[i] = 0;
+	}
+	runBitmapSpans(bitmap, count, radioFlicker, getSpansBlock, &spanCounter);
+	return spanCounter.realMaxSpan;
+}
+
+/**
+ * Finds the width of a single bit in number of samples.
+ *
+ * @param spans   - An array of at least maxSpan+1 integers
+ * @param maxSpan - The max span to record
+ * @return The width of a single bit in number of samples or 0 on error
+ */
+uint32_t findSingleBitWidth(const uint32_t *spans, uint32_t maxSpan)
+{
+	double minErr = 1e99;
+	double curErr;
+	uint32_t hi = 0;
+	uint32_t lo = maxSpan;
+	uint32_t bestSingleBitWidth = 0;
+
+	// Get hi and lo
+	for (uint32_t i = 0; i < maxSpan; i++)
+	{
+		if (spans[i] != 0)
+		{
+			lo = i;
+			break;
+		}
+	}
+	for (uint32_t i = maxSpan; i > lo; i--)
+	{
+		if (spans[i] != 0)
+		{
+			hi = i;
+			break;
+		}
+	}
+	if (lo > hi)
+	{
+		return 0;
+	}
+
+	// min 10 samples/bit
+	// max 256 bits without change
+	uint32_t endAt = hi / 256;
+	if (endAt < 10)
+	{
+		endAt = 10;
+	}
+
+	// Only the lengths seen, --tune measures many
+	std::vector<uint32_t> lengths;
+
+	for (uint32_t j = lo; j < hi; j++)
+	{
+		if (spans[j] != 0)
+		{
+			lengths.push_back(j);
+		}
+	}
+
+	// Brute force... meh
+	for (uint32_t i = hi; i >= endAt; i--)
+	{
+		curErr = 0;
+		for (size_t k = 0; k < lengths.size(); k++)
+		{
+			uint32_t j = lengths[k];
+			uint32_t error;
+			double scaledError;
+
+			error = j % i;
+			if (error > i - error)
+			{
+				error = i - error;
+			}
+			scaledError = (double) error / i;
+			curErr += scaledError * scaledError * spans[j];
+		}
+		if (minErr > curErr)
+		{
+			bestSingleBitWidth = i;
+			minErr = curErr;
+		}
+	}
+	return bestSingleBitWidth;
+}
+
+/**
+ * Gets how well spans fit a bit width. This is the error findSingleBitWidth() minimizes divided
+ * by the number of spans so different sets of spans can be compared.
+ *
+ * @param spans          - An array of maxSpan+1 integers
+ * @param maxSpan        - The max span
+ * @param singleBitWidth - The width of a single bit in number of samples
+ * @param numBits        - Receives the number of bits in the spans
+ * @return The mean squared error in bits
+ */
+double getBitWidthError(const uint32_t *spans, uint32_t maxSpan, uint32_t singleBitWidth, uint64_t *numBits)
+{
+	double   sumErr   = 0;
+	uint64_t numSpans = 0;
+
+	*numBits = 0;
+
+	for (uint32_t i = 0; i <= maxSpan; i++)
+	{
+		if (spans[i] != 0)
+		{
+			uint32_t error = i % singleBitWidth;
+			double   scaledError;
+
+			if (error > singleBitWidth - error)
+			{
+				error = singleBitWidth - error;
+			}
+			scaledError = (double) error / singleBitWidth;
+			sumErr   += scaledError * scaledError * spans[i];
+			numSpans += spans[i];
+			*numBits += (uint64_t) ((i + singleBitWidth / 2) / singleBitWidth) * spans[i];
+		}
+	}
+	return sumErr / numSpans;
+}
+
+/**
+ * Checks if spans fit their bit width better than the best so far. Fits with an error under
+ * FIT_MAX_ERROR beat ones over it. Of two that fit the one with more bits is better, a setting
+ * that only keeps the strongest messages fits them perfectly. Otherwise the lower error is
+ * better, counting bits would favor bits split by glitches.
+ *
+ * @param error     - The error from getBitWidthError()
+ * @param bits      - The number of bits from getBitWidthError()
+ * @param bestError - The error of the best so far
+ * @param bestBits  - The number of bits of the best so far
+ * @return If it's better
+ */
+bool isBetterFit(double error, uint64_t bits, double bestError, uint64_t bestBits)
+{
+	bool fits     = error < FIT_MAX_ERROR;
+	bool bestFits = bestError < FIT_MAX_ERROR;
+
+	if (fits != bestFits)
+	{
+		return fits;
+	}
+	if (fits && bits != bestBits)
+	{
+		return bits > bestBits;
+	}
+	return error < bestError;
+}
+
+/**
+ * Checks if two bit widths are within about 3% of each other.
+ */
+bool widthsAgree(uint32_t a, uint32_t b)
+{
+	uint32_t diff = a > b ? a - b : b - a;
+
+	return diff * 32 <= std::max(a, b);
+}
+
+/**
+ * Context of getThresholdSpansBlock().
+ */
+struct thresholdsContext
+{
+	uint32_t      thresholds[THRESHOLD_CANDIDATES];
+	spanExtractor extractors[THRESHOLD_CANDIDATES];
+	sampleBlock   blocks[THRESHOLD_CANDIDATES]; // The state bits and spans at each threshold
+	spansContext  spanCounters[THRESHOLD_CANDIDATES];
+};
+
+/**
+ * Thresholds a block of samples at each candidate threshold and counts the spans of each. See
+ * findBestThreshold().
+ */
+uint32_t getThresholdSpansBlock(const sampleBlock &block, void *context)
+{
+	thresholdsContext *candidates = (thresholdsContext*) context;
+
+	for (uint32_t i = 0; i < THRESHOLD_CANDIDATES; i++)
+	{
+		sampleBlock &sliced = candidates->blocks[i];
+
+		sliced.start = block.start;
+		sliced.count = block.count;
+		kernels.thresholdSamples(sliced.bits, block.samples, block.count, candidates->thresholds[i]);
+		extractSpans(candidates->extractors[i], sliced);
+		getSpansBlock(sliced, &candidates->spanCounters[i]);
+	}
+	return 0;
+}
+
+/**
+ * Tries THRESHOLD_CANDIDATES thresholds spread across the on/off range in one pass. Of the
+ * thresholds that measure the same bit width, picks the one whose spans fit it with the lowest
+ * error, and of equal errors the one nearest the middle of the range.
+ *
+ * @param counts         - The counts from getCounts()
+ * @param count          - The total number of samples
+ * @param radioFlicker   - Number samples needed to change the state
+ * @param stream         - The sample stream at the start of the data
+ * @param pipelined      - Run each stage on its own thread
+ * @param out            - Where to output the candidates
+ * @param onOffThreshold - Receives the threshold value between on and off
+ * @param singleBitWidth - Receives the width of a single bit in number of samples or 0 if no bit width holds across thresholds
+ * @return 0 on success, non-zero on error
+ */
+uint32_t findBestThreshold(const uint32_t *counts, uint32_t count, uint32_t radioFlicker, sampleStream &stream, uint32_t pipelined, FILE *out, uint32_t *onOffThreshold, uint32_t *singleBitWidth)
+{
+	thresholdsContext *candidates = new thresholdsContext;
+	uint32_t           lo;
+	uint32_t           hi;
+	uint32_t           widths[THRESHOLD_CANDIDATES];
+	double             errors[THRESHOLD_CANDIDATES];
+	uint32_t           support[THRESHOLD_CANDIDATES];
+	uint64_t           bits[THRESHOLD_CANDIDATES];
+	uint32_t           best     = 0;
+	uint32_t           error    = 0;
+	double             minError = 1;
+	uint32_t           minEdge  = 0; // Distance of the best from the middle, in half candidates
+
+	*onOffThreshold = 0;
+	*singleBitWidth = 0;
+	if (findOnOffRange(counts, count, stream.fileFormat, stream.countShift, &lo, &hi))
+	{
+		fprintf(stderr, "Error: Can't find on off ranges\n");
+		delete candidates;
+		return 1;
+	}
+	for (uint32_t i = 0; i < THRESHOLD_CANDIDATES; i++)
+	{
+		// Candidates without a bit width don't fit
+		widths[i] = 0;
+		errors[i] = 1;
+		bits[i]   = 0;
+
+		// Middle of each of THRESHOLD_CANDIDATES equal parts of the range
+		candidates->thresholds[i] = lo + (uint32_t) ((uint64_t) (hi - lo) * (2 * i + 1) / (2 * THRESHOLD_CANDIDATES));
+		candidates->extractors[i] = makeSpanExtractor(radioFlicker);
+		candidates->spanCounters[i].spans       = new uint32_t[MAX_SPAN + 1];
+		candidates->spanCounters[i].maxSpan     = MAX_SPAN;
+		candidates->spanCounters[i].realMaxSpan = 0;
+		candidates->spanCounters[i].bitmap      = NULL;
+		for (uint32_t j = 0; j <= MAX_SPAN; j++)
+		{
+			candidates->spanCounters[i].spans[j] = 0;
+		}
+	}
+
+	allocBlocks(candidates->blocks, THRESHOLD_CANDIDATES, 0);
+
+	fprintf(out, "Trying %u thresholds...\n", THRESHOLD_CANDIDATES);
+	if (runPipeline(stream, STAGE_READ, 0, radioFlicker, getThresholdSpansBlock, candidates, pipelined))
+	{
+		error = 1;
+	}
+	for (uint32_t i = 0; i < THRESHOLD_CANDIDATES && !error; i++)
+	{
+		const spansContext &spanCounter = candidates->spanCounters[i];
+		uint32_t            maxSpan     = std::min(spanCounter.realMaxSpan, (uint32_t) MAX_SPAN);
+
+		widths[i] = findSingleBitWidth(spanCounter.spans, maxSpan);
+		if (widths[i] == 0)
+		{
+			fprintf(out, "threshold %u: no bit width\n", candidates->thresholds[i]);
+			continue;
+		}
+		errors[i] = getBitWidthError(spanCounter.spans, maxSpan, widths[i], &bits[i]);
+		fprintf(out, "threshold %u: samples/bit %u, error %0.6f, bits %" PRIu64 "\n", candidates->thresholds[i], widths[i], errors[i], bits[i]);
+		if (bits[i] < THRESHOLD_MIN_BITS)
+		{
+			// Only caught a few peaks or the gaps between messages
+			widths[i] = 0;
+		}
+	}
+	freeBlocks(candidates->blocks, THRESHOLD_CANDIDATES, 0);
+	for (uint32_t i = 0; i < THRESHOLD_CANDIDATES; i++)
+	{
+		delete [] candidates->spanCounters[i].spans;
+	}
+	if (error)
+	{
+		delete candidates;
+		return 1;
+	}
+
+	// A threshold near the edge of the range fits noise, so only trust bit widths that hold across
+	// neighboring thresholds
+	for (uint32_t i = 0; i < THRESHOLD_CANDIDATES; i++)
+	{
+		support[i] = 0;
+		for (uint32_t j = 0; j < THRESHOLD_CANDIDATES && widths[i] != 0; j++)
+		{
+			if (j != i && widthsAgree(widths[i], widths[j]))
+			{
+				support[i]++;
+			}
+		}
+		if (support[best] < support[i] || (support[best] == support[i] && errors[best] > errors[i]))
+		{
+			best = i;
+		}
+	}
+	if (support[best] == 0)
+	{
+		fprintf(out, "No bit width holds across thresholds\n");
+		delete candidates;
+		return 0;
+	}
+
+	// Of the thresholds that agree, the one whose spans fit best. More bits isn't better: a
+	// threshold next to the noise floor adds bits of noise before and after each message.
+	for (uint32_t i = 0; i < THRESHOLD_CANDIDATES; i++)
+	{
+		uint32_t edge = (uint32_t) abs((int32_t) (2 * i) - (int32_t) (THRESHOLD_CANDIDATES - 1));
+
+		if (widths[i] != 0 && widthsAgree(widths[best], widths[i]) &&
+		    (*singleBitWidth == 0 || errors[i] < minError || (errors[i] == minError && edge < minEdge)))
+		{
+			minError        = errors[i];
+			minEdge         = edge;
+			*onOffThreshold = candidates->thresholds[i];
+			*singleBitWidth = widths[i];
+		}
+	}
+	delete candidates;
+	rewindStream(stream);
+	fprintf(out, "Using threshold %u\n", *onOffThreshold);
+	return 0;
+}
+
+/**
+ * Message bits packed into 64 bit words. The first bit is the most significant bit of the first word.
+ */
+struct bitWriter
+{
+	uint64_t *words;
+	uint64_t  numWords;  // Number of words allocated (unused words are 0)
+	uint64_t  bitLength;
+};
+
+/**
+ * Appends a run of identical bits.
+ *
+ * @param writer - The bit writer
+ * @param bit    - The value of the bits (0 or 1)
+ * @param count  - The number of bits
+ * @return 0 on success, non-zero on error
+ */
+uint32_t appendBits(bitWriter &writer, uint32_t bit, uint64_t count)
+{
+	uint64_t pos = writer.bitLength;
+	uint64_t end = pos + count;
+
+	if ((end + 63) / 64 > writer.numWords)
+	{
+		uint64_t  numWords = std::max(std::max(2 * writer.numWords, (end + 63) / 64), (uint64_t) 1024);
+		uint64_t *words    = (uint64_t*) realloc(writer.words, sizeof(uint64_t) * numWords);
+
+		if (words == NULL)
+		{
+			perror("realloc");
+			return 1;
+		}
+		memset(words + writer.numWords, 0, sizeof(uint64_t) * (numWords - writer.numWords));
+		writer.words    = words;
+		writer.numWords = numWords;
+	}
+	writer.bitLength = end;
+
+	// Zeros are already there
+	if (bit == 0)
+	{
+		return 0;
+	}
+	while (pos < end)
+	{
+		uint32_t offset = pos % 64;
+		uint64_t bits   = std::min((uint64_t) (64 - offset), end - pos);
+
+		if (bits == 64)
+		{
+			writer.words[pos / 64] = UINT64_MAX;
+		}
+		else
+		{
+			writer.words[pos / 64] |= (((uint64_t) 1 << bits) - 1) << (64 - offset - bits);
+		}
+		pos += bits;
+	}
+	return 0;
+}
+
+/**
+ * Outputs bits as hex then a new line.
+ *
+ * @param writer - The bits
+ * @param out    - Where to output
+ * @return 0 on success, non-zero on error
+ */
+uint32_t printBits(const bitWriter &writer, FILE *out)
+{
+	// Whole words are formatted and only the used bytes are output
+	uint64_t numWords = (writer.bitLength + 63) / 64;
+	char    *hex      = (char*) malloc(16 * numWords + 1);
+
+	if (hex == NULL)
+	{
+		perror("malloc");
+		return 1;
+	}
+	kernels.formatHex(hex, writer.words, numWords);
+	fwrite(hex, 1, 2 * ((writer.bitLength + 7) / 8), out);
+	fprintf(out, "\n");
+	free(hex);
+	return 0;
+}
+
+/**
+ * Splits the data into messages at gaps of PREAMBLE_GAP_BITS off bits for --max-messages and
+ * --match, and stops the pass once enough are output.
+ */
+struct messageFilter
+{
+	uint32_t    maxMessages; // Stop after this many messages are output or 0 for no limit
+	const char *match;       // Only output messages with these bits (0s and 1s) or NULL
+	uint32_t    numMessages; // Messages output
+	uint64_t    start;       // First sample of the current message
+	uint64_t    bitLength;   // Bits output
+};
+
+/**
+ * Checks if a message contains a pattern. The gaps around a message are off so bits before and
+ * after it are 0s.
+ *
+ * @param writer  - The message's bits
+ * @param pattern - The pattern (0s and 1s)
+ * @return Non-zero if the pattern is in the message
+ */
+uint32_t hasBits(const bitWriter &writer, const char *pattern)
+{
+	int64_t length = (int64_t) strlen(pattern);
+
+	for (int64_t pos = 1 - length; pos < (int64_t) writer.bitLength; pos++)
+	{
+		int64_t i = 0;
+
+		for (; i < length; i++)
+		{
+			int64_t  bit   = pos + i;
+			uint64_t value = 0;
+
+			if (bit >= 0 && bit < (int64_t) writer.bitLength)
+			{
+				value = (writer.words[bit / 64] >> (63 - bit % 64)) & 1;
+			}
+			if (value != (uint64_t) (pattern[i] - '0'))
+			{
+				break;
+			}
+		}
+		if (i == length)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Outputs a message if it matches and starts the next one.
+ *
+ * @param filter - The message filter
+ * @param writer - The message's bits (cleared)
+ * @param out    - Where to output the message
+ * @return 0 to continue, PIPELINE_DONE once enough messages are output or non-zero on error
+ */
+uint32_t finishMessage(messageFilter &filter, bitWriter &writer, FILE *out)
+{
+	uint32_t ret = 0;
+
+	if (filter.match == NULL || hasBits(writer, filter.match))
+	{
+		filter.numMessages++;
+		filter.bitLength += writer.bitLength;
+		fprintf(out, "\nMessage %u at sample %" PRIu64 ", bits %" PRIu64 "\n", filter.numMessages, filter.start, writer.bitLength);
+		if (printBits(writer, out))
+		{
+			return 1;
+		}
+		if (filter.numMessages == filter.maxMessages)
+		{
+			ret = PIPELINE_DONE;
+		}
+	}
+	memset(writer.words, 0, sizeof(uint64_t) * ((writer.bitLength + 63) / 64));
+	writer.bitLength = 0;
+	return ret;
+}
+
+/**
+ * Writes spans as rtl_433 style OOK pulse data. Each package is pulse and gap lengths in
+ * microseconds, one pair per line, and ends at a long gap.
+ */
+struct pulseExporter
+{
+	FILE                 *fout;
+	uint32_t              sampleRate;
+	double                scale;    // Microseconds per sample
+	uint64_t              resetGap; // Off spans at least this long end a package
+	std::vector<uint32_t> lengths;  // Pulse and gap lengths in samples of the current package
+	uint32_t              error;
+};
+
+/**
+ * Writes the current package of a pulse exporter.
+ *
+ * @param pulses - The pulse exporter
+ * @param gap    - The gap after the last pulse in samples
+ */
+void writePulsePackage(pulseExporter &pulses, uint64_t gap)
+{
+	std::vector<uint32_t> &lengths = pulses.lengths;
+
+	if (lengths.empty())
+	{
+		return;
+	}
+	lengths.push_back((uint32_t) std::min(gap, (uint64_t) UINT32_MAX));
+	fprintf(pulses.fout, ";ook %u pulses\n;samplerate %u Hz\n", (uint32_t) (lengths.size() / 2), pulses.sampleRate);
+	for (size_t i = 0; i < lengths.size(); i += 2)
+	{
+		fprintf(pulses.fout, "%" PRIu64 " %" PRIu64 "\n",
+			(uint64_t) (lengths[i]     * pulses.scale + 0.5),
+			(uint64_t) (lengths[i + 1] * pulses.scale + 0.5));
+	}
+	if (fprintf(pulses.fout, ";end\n") < 0)
+	{
+		pulses.error = 1;
+	}
+	lengths.clear();
+}
+
+/**
+ * Adds a span to a pulse exporter. Gaps before the first pulse of a package are dropped.
+ *
+ * @param pulses - The pulse exporter
+ * @param area   - The span
+ */
+void addPulseSpan(pulseExporter &pulses, const span &area)
+{
+	if (area.state)
+	{
+		pulses.lengths.push_back(area.length);
+	}
+	else if (!pulses.lengths.empty())
+	{
+		if (area.length >= pulses.resetGap)
+		{
+			writePulsePackage(pulses, area.length);
+		}
+		else
+		{
+			pulses.lengths.push_back(area.length);
+		}
+	}
+}
+
+/**
+ * State of printMessage() between blocks.
+ */
+struct messageContext
+{
+	uint32_t       singleBitWidth;
+	bitWriter      writer;
+	pulseExporter *pulses; // Also exports the spans or NULL
+	messageFilter *filter; // Outputs messages instead of all of the data or NULL
+	FILE          *out;
+};
+
+/**
+ * Appends the bits of the spans in a block. See printMessage().
+ */
+uint32_t printBlock(const sampleBlock &block, void *context)
+{
+	messageContext *message = (messageContext*) context;
+	uint32_t        singleBitWidth = message->singleBitWidth;
+
+	for (uint32_t i = 0; i < block.numSpans; i++)
+	{
+		// Round to the nearest number of bits
+		uint32_t bits = (block.spans[i].length + singleBitWidth / 2) / singleBitWidth;
+
+		if (message->pulses != NULL)
+		{
+			addPulseSpan(*message->pulses, block.spans[i]);
+		}
+		if (message->filter != NULL && block.spans[i].state == 0 && (bits >= PREAMBLE_GAP_BITS || message->writer.bitLength == 0))
+		{
+			// Gaps aren't part of a message
+			if (message->writer.bitLength != 0)
+			{
+				uint32_t ret = finishMessage(*message->filter, message->writer, message->out);
+
+				if (ret != 0)
+				{
+					return ret;
+				}
+			}
+			continue;
+		}
+		if (message->filter != NULL && message->writer.bitLength == 0)
+		{
+			// A message starts at its first span, even the first one (whose gap extractSpans() ignored)
+			message->filter->start = block.spans[i].start;
+		}
+		if (appendBits(message->writer, block.spans[i].state, bits))
+		{
+			return 1;
+		}
+	}
+	return message->pulses != NULL ? message->pulses->error : 0;
+}
+
+/**
+ * Outputs the data.
+ *
+ * @param singleBitWidth - The width of a single bit in number of samples
+ * @param onOffThreshold - The threshold value between on and off
+ * @param radioFlicker   - Number samples needed to change the state
+ * @param stream         - The sample stream at the start of the data
+ * @param pipelined      - Run each stage on its own thread
+ * @param pulses         - Also exports the spans or NULL
+ * @param filter         - Outputs messages instead of all of the data or NULL
+ * @param out            - Where to output the data
+ * @return The bit length of the data or UINT32_MAX on error
+ */
+uint32_t printMessage(uint32_t singleBitWidth, uint32_t onOffThreshold, uint32_t radioFlicker, sampleStream &stream, uint32_t pipelined, pulseExporter *pulses, messageFilter *filter, FILE *out)
+{
+	messageContext message = {singleBitWidth, {NULL, 0, 0}, pulses, filter, out};
+	bitWriter     &writer  = message.writer;
+
+	if (runPipeline(stream, STAGE_SPANS, onOffThreshold, radioFlicker, printBlock, &message, pipelined))
+	{
+		free(writer.words);
+		return UINT32_MAX;
+	}
+	if (pulses != NULL)
+	{
+		// The last span never ends
+		writePulsePackage(*pulses, pulses->resetGap);
+		if (pulses->error)
+		{
+			perror("Error: Writing pulses");
+			free(writer.words);
+			return UINT32_MAX;
+		}
+	}
+
+	if (filter != NULL)
+	{
+		// The last message ends with the stream
+		if (writer.bitLength != 0 && filter->numMessages != filter->maxMessages && finishMessage(*filter, writer, out) == 1)
+		{
+			free(writer.words);
+			return UINT32_MAX;
+		}
+		fprintf(out, "Messages: %u\n", filter->numMessages);
+		free(writer.words);
+		return (uint32_t) filter->bitLength;
+	}
+	if (printBits(writer, out))
+	{
+		free(writer.words);
+		return UINT32_MAX;
+	}
+	free(writer.words);
+	return (uint32_t) writer.bitLength;
+}
+
+/**
+ * Tries AUTO_FLICKER_CANDIDATES flickers from a quarter of the bit width measured at
+ * RADIO_FLICKER, counting the spans of each from the states kept by getSpans(). A flicker has to
+ * stay under half of the bit width it measures. Picks the one whose spans fit their bit width
+ * best (see isBetterFit()), including RADIO_FLICKER which wins ties. The width measured at
+ * RADIO_FLICKER isn't trusted since glitches that split bits are what a bigger flicker is for.
+ *
+ * @param spans          - An array of MAX_SPAN+1 integers with the spans at RADIO_FLICKER (overwritten)
+ * @param bitmap         - The state of each sample from getSpans()
+ * @param count          - Number of samples
+ * @param out            - Where to output the candidates
+ * @param singleBitWidth - The width of a single bit at RADIO_FLICKER. Receives the width at the best flicker
+ * @param radioFlicker   - Receives the best flicker
+ */
+void findBestFlicker(uint32_t *spans, uint64_t *bitmap, uint64_t count, FILE *out, uint32_t *singleBitWidth, uint32_t *radioFlicker)
+{
+	uint32_t measured = *singleBitWidth;
+	uint32_t width    = *singleBitWidth;
+	uint32_t flicker  = RADIO_FLICKER;
+	uint32_t maxSpan  = MAX_SPAN;
+	double   minError = 1e99;
+	uint64_t maxBits  = 0;
+
+	for (uint32_t i = 0; i <= AUTO_FLICKER_CANDIDATES; i++)
+	{
+		uint64_t bits;
+		double   error;
+
+		if (i != 0)
+		{
+			uint32_t last = flicker;
+
+			flicker = std::max(measured >> (i + 1), (uint32_t) 1);
+			if (flicker == last || flicker == RADIO_FLICKER)
+			{
+				// Already tried
+				continue;
+			}
+			maxSpan = std::min(getBitmapSpans(spans, MAX_SPAN, flicker, bitmap, count), (uint32_t) MAX_SPAN);
+			*singleBitWidth = findSingleBitWidth(spans, maxSpan);
+		}
+		if (*singleBitWidth == 0 || 2 * flicker >= *singleBitWidth)
+		{
+			fprintf(out, "flicker %u: no bit width\n", flicker);
+			continue;
+		}
+		error = getBitWidthError(spans, maxSpan, *singleBitWidth, &bits);
+		fprintf(out, "flicker %u: samples/bit %u, error %0.6f, bits %" PRIu64 "\n", flicker, *singleBitWidth, error, bits);
+		if (isBetterFit(error, bits, minError, maxBits))
+		{
+			minError      = error;
+			maxBits       = bits;
+			*radioFlicker = flicker;
+			width         = *singleBitWidth;
+		}
+	}
+	*singleBitWidth = width;
+	fprintf(out, "Using flicker %u\n", *radioFlicker);
+}
+
+/**
+ * Finds the on/off threshold and the width of a single bit from the samples up to stream.limit.
+ * With --flicker auto the spans are counted at RADIO_FLICKER to measure the bit width, then at
+ * fractions of a bit from the states kept from the first count (see findBestFlicker()).
+ *
+ * @param stream         - The sample stream at the start of the data (rewound on success)
+ * @param options        - The settings
+ * @param out            - Where to output progress
+ * @param onOffThreshold - Receives the threshold value between on and off
+ * @param singleBitWidth - Receives the width of a single bit in number of samples
+ * @param radioFlicker   - Receives the number samples needed to change the state
+ * @return 0 on success, non-zero on error
+ */
+uint32_t measureSamples(sampleStream &stream, const decodeOptions &options, FILE *out, uint32_t *onOffThreshold, uint32_t *singleBitWidth, uint32_t *radioFlicker)
+{
+	uint32_t *counts;
+	uint32_t *spans;
+	uint32_t  count;
+	size_t    numCounts = getNumCounts(stream);
+
+	*radioFlicker = options.flicker != 0 ? options.flicker : RADIO_FLICKER;
+
+	// Check for size overflow
+	if (numCounts == 0)
+	{
+		fprintf(stderr, "Error: 32 bit samples requires a 64 bit binary and 16 GiB of RAM.\n");
+		return 1;
+	}
+	counts = (uint32_t*) allocLarge(numCounts * sizeof(uint32_t), LARGE_COUNTS);
+
+	// Count samples
+	fprintf(out, "Counting...\n");
+	count = getCounts(counts, stream, options.pipelined);
+	if (count == UINT32_MAX)
+	{
+		freeLarge(counts, numCounts * sizeof(uint32_t));
+		return 1;
+	}
+	rewindStream(stream);
+
+	// Finding on off ranges
+	fprintf(out, "Finding on off ranges...\n");
+	if (options.multiThreshold)
+	{
+		if (findBestThreshold(counts, count, *radioFlicker, stream, options.pipelined, out, onOffThreshold, singleBitWidth))
+		{
+			freeLarge(counts, numCounts * sizeof(uint32_t));
+			return 1;
+		}
+		if (*singleBitWidth != 0)
+		{
+			freeLarge(counts, numCounts * sizeof(uint32_t));
+			return 0;
+		}
+		rewindStream(stream);
+	}
+	*onOffThreshold = findOnOffThreshold(counts, count, stream.fileFormat, stream.countShift, options.thresholdLevel);
+	freeLarge(counts, numCounts * sizeof(uint32_t));
+	if (*onOffThreshold == 0)
+	{
+		fprintf(stderr, "Error: Can't find on off ranges\n");
+		return 1;
+	}
+
+	// Getting spans
+	uint64_t *bitmap      = NULL;
+	size_t    bitmapBytes = ((size_t) count + 63) / 64 * sizeof(uint64_t);
+
+	fprintf(out, "Getting spans...\n");
+	if (options.flicker == 0)
+	{
+		bitmap = (uint64_t*) allocLarge(bitmapBytes, LARGE_SAMPLES);
+	}
+	spans = new uint32_t[MAX_SPAN + 1];
+	uint32_t realMaxSpan = getSpans(spans, MAX_SPAN, *onOffThreshold, *radioFlicker, stream, options.pipelined, bitmap);
+	if (realMaxSpan == UINT32_MAX)
+	{
+		fprintf(stderr, "Error: 1\n");
+		delete [] spans;
+		if (bitmap != NULL)
+		{
+			freeLarge(bitmap, bitmapBytes);
+		}
+		return 1;
+	}
+	rewindStream(stream);
+
+	// Finding single bit width
+	fprintf(out, "Finding single bit width...\n");
+	*singleBitWidth = findSingleBitWidth(spans, realMaxSpan);
+	if (bitmap != NULL && *singleBitWidth != 0)
+	{
+		findBestFlicker(spans, bitmap, count, out, singleBitWidth, radioFlicker);
+	}
+	if (bitmap != NULL)
+	{
+		freeLarge(bitmap, bitmapBytes);
+	}
+	delete [] spans;
+	if (*singleBitWidth == 0)
+	{
+		fprintf(stderr, "Error: 2\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Finds the on/off threshold and the width of a single bit from the samples or only the first
+ * --prefix of them.
+ *
+ * @param stream         - The sample stream at the start of the data (rewound on success)
+ * @param sampleRate     - The sample rate or 0 if unknown
+ * @param options        - The settings
+ * @param out            - Where to output progress
+ * @param onOffThreshold - Receives the threshold value between on and off
+ * @param singleBitWidth - Receives the width of a single bit in number of samples
+ * @param radioFlicker   - Receives the number samples needed to change the state
+ * @return 0 on success, non-zero on error
+ */
+uint32_t measureStream(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out, uint32_t *onOffThreshold, uint32_t *singleBitWidth, uint32_t *radioFlicker)
+{
+	uint64_t limit = stream.limit;
+	uint32_t error;
+
+	if (options.prefix > 0)
+	{
+		uint64_t prefix = std::max((uint64_t) (options.prefix * (sampleRate != 0 ? sampleRate : 1)), (uint64_t) 1);
+
+		if (limit == 0 || prefix < limit)
+		{
+			stream.limit = prefix;
+		}
+		fprintf(out, "Measuring the first %" PRIu64 " samples...\n", stream.limit);
+	}
+	error = measureSamples(stream, options, out, onOffThreshold, singleBitWidth, radioFlicker);
+	stream.limit = limit;
+	return error;
+}
+
+/**
+ * Finds the on/off threshold and the width of a single bit then outputs the data.
+ *
+ * @param stream     - The sample stream at the start of the data
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress and the data
+ * @return The bit length of the data or UINT32_MAX on error
+ */
+uint32_t decodeStream(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	uint32_t bitLength;
+	uint32_t singleBitWidth;
+	uint32_t onOffThreshold;
+	uint32_t radioFlicker;
+
+	if (measureStream(stream, sampleRate, options, out, &onOffThreshold, &singleBitWidth, &radioFlicker))
+	{
+		return UINT32_MAX;
+	}
+
+	// Print bit width
+	fprintf(out, "samples/bit: %u\n", singleBitWidth);
+	if (sampleRate != 0)
+	{
+		fprintf(out, "seconds/bit: %0.9f\n", (double) singleBitWidth / sampleRate);
+		fprintf(out, "bits/second: %0.3f\n", (double) sampleRate / singleBitWidth);
+	}
+
+	// Print message
+	if (options.pulseFile != NULL && sampleRate == 0)
+	{
+		fprintf(stderr, "Error: --export-pulses needs the sample rate (use --sample-rate for raw files)\n");
+		return UINT32_MAX;
+	}
+	messageFilter  filter    = {options.maxMessages, options.match, 0, 0, 0};
+	messageFilter *filterPtr = NULL;
+
+	if (options.maxMessages != 0 || options.match != NULL)
+	{
+		filterPtr = &filter;
+	}
+	if (options.pulseFile != NULL)
+	{
+		pulseExporter pulses = {options.pulseFile, sampleRate, 1e6 / sampleRate, (uint64_t) PREAMBLE_GAP_BITS * singleBitWidth, std::vector<uint32_t>(), 0};
+
+		bitLength = printMessage(singleBitWidth, onOffThreshold, radioFlicker, stream, options.pipelined, &pulses, filterPtr, out);
+	}
+	else
+	{
+		bitLength = printMessage(singleBitWidth, onOffThreshold, radioFlicker, stream, options.pipelined, NULL, filterPtr, out);
+	}
+	if (bitLength == UINT32_MAX)
+	{
+		fprintf(stderr, "Error: Durp?\n");
+		return UINT32_MAX;
+	}
+	return bitLength;
+}
+
+/**
+ * Outputs the data of each package of rtl_433 style OOK pulse data (see pulseExporter). Lengths
+ * are turned into samples at the file's ";samplerate" (or sampleRate or 48 kHz) since
+ * findSingleBitWidth() expects at least 10 samples per bit. Packages can be from different devices
+ * so each package's bit width is found from its pulses and gaps except the last gap.
+ *
+ * @param fin        - The pulse data
+ * @param sampleRate - The sample rate if the file doesn't have one or 0
+ * @param out        - Where to output progress and the data
+ * @return The total bit length of the packages or UINT32_MAX on error
+ */
+uint32_t decodePulses(FILE *fin, uint32_t sampleRate, FILE *out)
+{
+	std::vector<std::vector<double> > packages; // Pulse and gap lengths in microseconds
+	char      line[256];
+	double    timescale = 1; // Microseconds per unit
+	uint32_t  inPackage = 0;
+	uint32_t  fileRate  = 0; // The file's ";samplerate" wins over sampleRate
+	uint32_t *spans;
+	uint64_t  bitLength = 0;
+
+	fprintf(out, "Reading pulses...\n");
+	while (fgets(line, sizeof(line), fin) != NULL)
+	{
+		double pulse;
+		double gap;
+
+		if (strncmp(line, ";timescale", 10) == 0)
+		{
+			timescale = strtod(line + 10, NULL);
+			if (!(timescale > 0))
+			{
+				timescale = 1;
+			}
+		}
+		else if (strncmp(line, ";samplerate", 11) == 0)
+		{
+			fileRate = (uint32_t) strtoul(line + 11, NULL, 10);
+		}
+		else if (strncmp(line, ";ook", 4) == 0)
+		{
+			packages.push_back(std::vector<double>());
+			inPackage = 1;
+		}
+		else if (strncmp(line, ";fsk", 4) == 0 || strncmp(line, ";end", 4) == 0)
+		{
+			inPackage = 0;
+		}
+		else if (line[0] != ';' && sscanf(line, "%lf %lf", &pulse, &gap) == 2)
+		{
+			// Lines outside of ";ook" and ";end" are a package
+			if (!inPackage)
+			{
+				packages.push_back(std::vector<double>());
+				inPackage = 1;
+			}
+			packages.back().push_back(pulse * timescale);
+			packages.back().push_back(gap   * timescale);
+		}
+	}
+	if (ferror(fin))
+	{
+		perror("fgets");
+		return UINT32_MAX;
+	}
+	if (fileRate != 0)
+	{
+		sampleRate = fileRate;
+	}
+	if (sampleRate == 0)
+	{
+		sampleRate = 48000;
+	}
+	fprintf(out, "Packages: %u\n", (uint32_t) packages.size());
+
+	// Lengths in samples
+	std::vector<std::vector<uint32_t> > lengths(packages.size());
+	for (size_t i = 0; i < packages.size(); i++)
+	{
+		for (size_t j = 0; j < packages[i].size(); j++)
+		{
+			double length = packages[i][j] * sampleRate / 1e6 + 0.5;
+
+			lengths[i].push_back((uint32_t) std::min(std::max(length, 1.0), (double) UINT32_MAX));
+		}
+	}
+
+	spans = new uint32_t[MAX_SPAN + 1];
+	for (size_t i = 0; i < lengths.size(); i++)
+	{
+		bitWriter writer      = {NULL, 0, 0};
+		uint32_t  realMaxSpan = 0;
+		uint32_t  error       = 0;
+
+		fprintf(out, "\nPackage %u: %u pulses\n", (uint32_t) i + 1, (uint32_t) (lengths[i].size() / 2));
+
+		// Finding single bit width
+		for (uint32_t j = 0; j <= MAX_SPAN; j++)
+		{
+			spans[j] = 0;
+		}
+		for (size_t j = 0; j + 1 < lengths[i].size(); j++)
+		{
+			realMaxSpan = std::max(realMaxSpan, lengths[i][j]);
+			if (lengths[i][j] <= MAX_SPAN)
+			{
+				spans[lengths[i][j]]++;
+			}
+		}
+		uint32_t singleBitWidth = findSingleBitWidth(spans, std::min(realMaxSpan, (uint32_t) MAX_SPAN));
+		if (singleBitWidth == 0)
+		{
+			fprintf(stderr, "Error: Package %u: No bit width found in its pulses and gaps\n", (uint32_t) i + 1);
+			continue;
+		}
+		fprintf(out, "samples/bit: %u\n", singleBitWidth);
+		fprintf(out, "seconds/bit: %0.9f\n", (double) singleBitWidth / sampleRate);
+		fprintf(out, "bits/second: %0.3f\n", (double) sampleRate / singleBitWidth);
+
+		// Print message
+		for (size_t j = 0; j + 1 < lengths[i].size() && !error; j++)
+		{
+			// Round to the nearest number of bits
+			error = appendBits(writer, (j & 1) == 0, (lengths[i][j] + singleBitWidth / 2) / singleBitWidth);
+		}
+		if (error || printBits(writer, out))
+		{
+			free(writer.words);
+			delete [] spans;
+			return UINT32_MAX;
+		}
+		bitLength += writer.bitLength;
+		free(writer.words);
+	}
+	delete [] spans;
+	return (uint32_t) std::min(bitLength, (uint64_t) UINT32_MAX - 1);
+}
+
+/**
+ * Precomputed tables for fft().
+ */
+struct fftPlan
+{
+	uint32_t  size;
+	uint32_t *bitReverse;
+	float    *cosTable;   // cos(2*pi*i/size) for i < size/2
+	float    *sinTable;   // sin(2*pi*i/size) for i < size/2
+};
+
+/**
+ * Makes the tables for fft().
+ *
+ * @param size - The FFT size (a power of 2)
+ * @return The FFT plan
+ */
+fftPlan makeFftPlan(uint32_t size)
+{
+	fftPlan  plan;
+	uint32_t bits = 0;
+
+	while ((((uint32_t) 1) << bits) < size)
+	{
+		bits++;
+	}
+	plan.size       = size;
+	plan.bitReverse = new uint32_t[size];
+	plan.cosTable   = new float[size / 2 + 1];
+	plan.sinTable   = new float[size / 2 + 1];
+	for (uint32_t i = 0; i < size; i++)
+	{
+		uint32_t reversed = 0;
+
+		for (uint32_t j = 0; j < bits; j++)
+		{
+			reversed |= ((i >> j) & 1) << (bits - j - 1);
+		}
+		plan.bitReverse[i] = reversed;
+	}
+	for (uint32_t i = 0; i <= size / 2; i++)
+	{
+		plan.cosTable[i] = (float) cos(2 * M_PI * i / size);
+		plan.sinTable[i] = (float) sin(2 * M_PI * i / size);
+	}
+	return plan;
+}
+
+/**
+ * Frees the tables made by makeFftPlan().
+ *
+ * @param plan - The FFT plan
+ */
+void freeFftPlan(fftPlan &plan)
+{
+	delete [] plan.bitReverse;
+	delete [] plan.cosTable;
+	delete [] plan.sinTable;
+	plan.bitReverse = NULL;
+	plan.cosTable   = NULL;
+	plan.sinTable   = NULL;
+}
+
+/**
+ * In place radix-2 FFT.
+ *
+ * @param plan    - The FFT plan from makeFftPlan()
+ * @param re      - Real parts (plan.size values)
+ * @param im      - Imaginary parts (plan.size values)
+ * @param inverse - Non-zero for the inverse FFT (not scaled by 1/size)
+ */
+void fft(const fftPlan &plan, float *re, float *im, uint32_t inverse = 0)
+{
+	uint32_t size = plan.size;
+	float    sign = -1.0f;
+
+	if (inverse)
+	{
+		sign = 1.0f;
+	}
+	for (uint32_t i = 0; i < size; i++)
+	{
+		uint32_t j = plan.bitReverse[i];
+
+		if (i < j)
+		{
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+	for (uint32_t len = 2; len <= size; len <<= 1)
+	{
+		uint32_t half = len / 2;
+		uint32_t step = size / len;
+
+		for (uint32_t i = 0; i < size; i += len)
+		{
+			for (uint32_t k = 0; k < half; k++)
+			{
+				float    wr = plan.cosTable[k * step];
+				float    wi = sign * plan.sinTable[k * step];
+				uint32_t a  = i + k;
+				uint32_t b  = a + half;
+				float    tr = re[b] * wr - im[b] * wi;
+				float    ti = re[b] * wi + im[b] * wr;
+
+				re[b]  = re[a] - tr;
+				im[b]  = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+/**
+ * Reads I/Q samples from the input file. Channel 0 is I and channel 1 is Q.
+ *
+ * @param re         - Receives the in-phase values
+ * @param im         - Receives the quadrature values
+ * @param count      - Number of I/Q samples to read
+ * @param fin        - The input file at an offset into the data
+ * @param fileFormat - The file format
+ * @return The number of I/Q samples read
+ */
+uint32_t getIqSamples(float *re, float *im, uint32_t count, FILE *fin, uint32_t fileFormat)
+{
+	uint32_t frame[256];
+	float    center = (float) (((uint64_t) 1) << (8 * getSampleByteSize(fileFormat) - 1));
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (getFrame(frame, fin, fileFormat))
+		{
+			return i;
+		}
+		re[i] = (float) frame[0] - center;
+		im[i] = (float) frame[1] - center;
+	}
+	return count;
+}
+
+/**
+ * Gets the number of outputs correlate() makes per FFT block. Correlating in pieces that are a
+ * multiple of this gives the same values as correlating everything at once.
+ *
+ * @param length - Number of values in the template
+ * @return The outputs per block (1 if correlate() doesn't use FFTs)
+ */
+uint32_t getCorrelationStep(uint32_t length)
+{
+	if (length <= PREAMBLE_DIRECT_MAX)
+	{
+		return 1;
+	}
+
+	uint32_t size = 256;
+
+	while (size < 4 * length)
+	{
+		size <<= 1;
+	}
+
+	// Each block of size samples gives size-length+1 outputs that don't wrap around
+	return size - length + 1;
+}
+
+/**
+ * Correlates samples with a template. Templates longer than PREAMBLE_DIRECT_MAX use FFT
+ * overlap-save.
+ *
+ * @param corr   - Receives count-length+1 values: corr[i] = sum of x[i+k]*tmpl[k]
+ * @param x      - The samples
+ * @param count  - Number of samples (at least length)
+ * @param tmpl   - The template
+ * @param length - Number of values in tmpl
+ */
+void correlate(float *corr, const float *x, uint64_t count, const float *tmpl, uint32_t length)
+{
+	uint64_t numCorr = count - length + 1;
+
+	if (length <= PREAMBLE_DIRECT_MAX)
+	{
+		for (uint64_t i = 0; i < numCorr; i++)
+		{
+			float sum = 0;
+
+			for (uint32_t k = 0; k < length; k++)
+			{
+				sum += x[i + k] * tmpl[k];
+			}
+			corr[i] = sum;
+		}
+		return;
+	}
+
+	uint32_t stepSize = getCorrelationStep(length);
+	uint32_t size     = stepSize + length - 1;
+	fftPlan  plan     = makeFftPlan(size);
+	float   *tmplRe   = new float[size];
+	float   *tmplIm   = new float[size];
+	float   *re       = new float[size];
+	float   *im       = new float[size];
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		tmplRe[i] = 0;
+		tmplIm[i] = 0;
+		if (i < length)
+		{
+			tmplRe[i] = tmpl[i];
+		}
+	}
+	fft(plan, tmplRe, tmplIm);
+	for (uint64_t start = 0; start < numCorr; start += stepSize)
+	{
+		for (uint32_t i = 0; i < size; i++)
+		{
+			re[i] = 0;
+			im[i] = 0;
+			if (start + i < count)
+			{
+				re[i] = x[start + i];
+			}
+		}
+		fft(plan, re, im);
+
+		// Multiply by the conjugate of the template to correlate
+		for (uint32_t i = 0; i < size; i++)
+		{
+			float r = re[i] * tmplRe[i] + im[i] * tmplIm[i];
+
+			im[i] = im[i] * tmplRe[i] - re[i] * tmplIm[i];
+			re[i] = r;
+		}
+		fft(plan, re, im, 1);
+
+		uint64_t valid = std::min((uint64_t) stepSize, numCorr - start);
+		for (uint64_t i = 0; i < valid; i++)
+		{
+			corr[start + i] = re[i] / size;
+		}
+	}
+	freeFftPlan(plan);
+	delete [] tmplRe;
+	delete [] tmplIm;
+	delete [] re;
+	delete [] im;
+}
+
+/**
+ * Gets the average of the samples in a bit.
+ *
+ * @param x     - The samples
+ * @param start - The first sample of bit 0
+ * @param bit   - The bit number
+ * @param width - The width of a single bit in number of samples
+ * @return The average
+ */
+double getBitLevel(const float *x, uint64_t start, uint64_t bit, double width)
+{
+	uint64_t first = start + (uint64_t) (bit * width + 0.5);
+	uint64_t last  = start + (uint64_t) ((bit + 1) * width + 0.5);
+	double   sum   = 0;
+
+	for (uint64_t i = first; i < last; i++)
+	{
+		sum += x[i];
+	}
+	return sum / (last - first);
+}
+
+/**
+ * The part of the stream findPackets() is looking at: the centered samples and their correlations
+ * with the preamble. Both are dropped once they're behind the search so memory doesn't grow with
+ * the stream.
+ */
+struct packetWindow
+{
+	sampleStream      *stream;
+	uint32_t          *block;      // getSamples() buffer of SAMPLE_BLOCK_SIZE
+	float              mean;       // Subtracted from the samples
+	uint64_t           count;      // Samples in the stream
+	uint64_t           numCorr;    // Correlations in the stream
+	const float       *tmpl;
+	uint32_t           length;     // Values in tmpl
+	uint64_t           chunkSize;  // Correlations made at a time (a multiple of getCorrelationStep())
+	std::vector<float> x;          // Centered samples from sample xFirst
+	uint64_t           xFirst;
+	std::vector<float> corr;       // Correlations from sample corrFirst
+	uint64_t           corrFirst;
+};
+
+/**
+ * Moves a packet window back to the first sample.
+ *
+ * @param window - The packet window
+ */
+void rewindPacketWindow(packetWindow &window)
+{
+	rewindStream(*window.stream);
+	window.x.clear();
+	window.xFirst = 0;
+	window.corr.clear();
+	window.corrFirst = 0;
+}
+
+/**
+ * Reads samples into a packet window.
+ *
+ * @param window - The packet window
+ * @param end    - The sample after the last one needed
+ * @return 0 on success, non-zero on error
+ */
+uint32_t fillPacketWindow(packetWindow &window, uint64_t end)
+{
+	uint32_t error = 0;
+
+	end = std::min(end, window.count);
+	while (window.xFirst + window.x.size() < end && !window.stream->eof)
+	{
+		// Like STAGE_READ, never past the stream's limit
+		uint64_t want  = std::min((uint64_t) SAMPLE_BLOCK_SIZE, window.count - (window.xFirst + window.x.size()));
+		uint32_t count = getSamples(window.block, (uint32_t) want, *window.stream, &error);
+
+		if (error)
+		{
+			return 1;
+		}
+		for (uint32_t i = 0; i < count; i++)
+		{
+			window.x.push_back((float) window.block[i] - window.mean);
+		}
+	}
+	if (window.xFirst + window.x.size() < end)
+	{
+		fprintf(stderr, "Error: Reading samples\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Correlates a packet window's samples with the preamble.
+ *
+ * @param window - The packet window
+ * @param end    - The sample after the last correlation needed
+ * @return 0 on success, non-zero on error
+ */
+uint32_t correlatePacketWindow(packetWindow &window, uint64_t end)
+{
+	end = std::min(end, window.numCorr);
+	while (window.corrFirst + window.corr.size() < end)
+	{
+		// Chunks start at multiples of chunkSize so the values don't depend on where the search is
+		uint64_t first = window.corrFirst + window.corr.size();
+		uint64_t count = std::min(window.chunkSize, window.numCorr - first);
+		size_t   size  = window.corr.size();
+
+		if (fillPacketWindow(window, first + count + window.length - 1))
+		{
+			return 1;
+		}
+		window.corr.resize(size + count);
+		correlate(&window.corr[size], &window.x[first - window.xFirst], count + window.length - 1, window.tmpl, window.length);
+	}
+	return 0;
+}
+
+/**
+ * Drops the samples and correlations before a sample that a packet window no longer needs.
+ *
+ * @param window - The packet window
+ * @param first  - The first sample still needed
+ */
+void dropPacketWindow(packetWindow &window, uint64_t first)
+{
+	// Samples are still needed from where the next correlations start
+	uint64_t xFirst = std::min(first, window.corrFirst + window.corr.size());
+
+	// Dropping a chunk at a time keeps the copying down
+	if (first >= window.corrFirst + window.chunkSize)
+	{
+		uint64_t drop = std::min(first - window.corrFirst, (uint64_t) window.corr.size());
+
+		window.corr.erase(window.corr.begin(), window.corr.begin() + drop);
+		window.corrFirst += drop;
+	}
+	if (xFirst >= window.xFirst + window.chunkSize)
+	{
+		uint64_t drop = std::min(xFirst - window.xFirst, (uint64_t) window.x.size());
+
+		window.x.erase(window.x.begin(), window.x.begin() + drop);
+		window.xFirst += drop;
+	}
+}
+
+/**
+ * Finds packets by correlating the samples with the preamble then outputs the data of each packet.
+ * A packet is where the correlation is more than options.correlation times the noise (the median
+ * absolute correlation / 0.6745, which assumes packets are less than half of the samples, but at
+ * least the correlation of noise of 1 per sample so silence doesn't make every correlation a
+ * peak). The threshold between on and off is halfway between the average level of the preamble's
+ * on and off bits. Each bit is on if its average is above the threshold. Peaks where the preamble
+ * decodes with more than 1 bit error per PREAMBLE_ERROR_BITS bits are skipped. A packet ends after
+ * options.packetBits bits or PREAMBLE_GAP_BITS off bits. The stream is read three times (for the
+ * mean, the noise and the packets) and correlated a chunk at a time.
+ *
+ * @param stream     - The sample stream at the start of the data
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings (preamble, bitWidth, packetBits and correlation)
+ * @param out        - Where to output progress and the data
+ * @return The total bit length of the packets or UINT32_MAX on error
+ */
+uint32_t findPackets(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	const char  *preamble   = options.preamble;
+	uint32_t     numBits    = (uint32_t) strlen(preamble);
+	double       width      = options.bitWidth;
+	uint32_t     error;
+	double       mean       = 0;
+	uint64_t     count      = 0;
+	uint32_t     numPackets = 0;
+	uint32_t     bitLength  = 0;
+	packetWindow window;
+
+	if (width == 0)
+	{
+		uint32_t onOffThreshold;
+		uint32_t singleBitWidth;
+		uint32_t radioFlicker;
+
+		if (measureStream(stream, sampleRate, options, out, &onOffThreshold, &singleBitWidth, &radioFlicker))
+		{
+			return UINT32_MAX;
+		}
+		width = singleBitWidth;
+	}
+	fprintf(out, "samples/bit: %0.3f\n", width);
+	if (sampleRate != 0)
+	{
+		fprintf(out, "seconds/bit: %0.9f\n", width / sampleRate);
+		fprintf(out, "bits/second: %0.3f\n", sampleRate / width);
+	}
+
+	// The mean and number of samples up to the stream's limit, like STAGE_READ
+	window.block = new uint32_t[SAMPLE_BLOCK_SIZE];
+	do
+	{
+		uint64_t want       = std::min((uint64_t) SAMPLE_BLOCK_SIZE, stream.limit != 0 ? stream.limit - count : UINT64_MAX);
+		uint32_t blockCount = getSamples(window.block, (uint32_t) want, stream, &error);
+
+		for (uint32_t i = 0; i < blockCount; i++)
+		{
+			mean += window.block[i];
+		}
+		count += blockCount;
+	} while (!stream.eof && !error && (stream.limit == 0 || count < stream.limit));
+	if (error)
+	{
+		delete [] window.block;
+		return UINT32_MAX;
+	}
+
+	// Template is the preamble without its DC
+	uint32_t length   = (uint32_t) ceil(numBits * width);
+	float   *tmpl     = new float[length];
+	double   tmplMean = 0;
+	double   tmplNorm = 0;
+
+	for (uint32_t i = 0; i < length; i++)
+	{
+		tmpl[i] = (float) (preamble[std::min((uint32_t) (i / width), numBits - 1)] - '0');
+		tmplMean += tmpl[i];
+	}
+	tmplMean /= length;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		tmpl[i] -= (float) tmplMean;
+		tmplNorm += tmpl[i] * tmpl[i];
+	}
+	if (count < length)
+	{
+		fprintf(stderr, "Error: Fewer samples than the preamble\n");
+		delete [] window.block;
+		delete [] tmpl;
+		return UINT32_MAX;
+	}
+
+	// Centering keeps the correlation sums small
+	uint32_t step = getCorrelationStep(length);
+
+	mean /= count;
+	window.stream    = &stream;
+	window.mean      = (float) mean;
+	window.count     = count;
+	window.numCorr   = count - length + 1;
+	window.tmpl      = tmpl;
+	window.length    = length;
+	window.chunkSize = (uint64_t) step * std::max(SAMPLE_BLOCK_SIZE / step, (uint32_t) 1);
+
+	fprintf(out, "Correlating with a %u bit preamble (%u samples)...\n", numBits, length);
+	uint64_t numCorr = window.numCorr;
+
+	// Noise is from the median of up to 2^20 correlation values
+	uint64_t           stride = numCorr / (1 << 20) + 1;
+	std::vector<float> noise;
+
+	rewindPacketWindow(window);
+	for (uint64_t i = 0; i < numCorr; i += stride)
+	{
+		if (correlatePacketWindow(window, i + 1))
+		{
+			delete [] window.block;
+			delete [] tmpl;
+			return UINT32_MAX;
+		}
+		noise.push_back(fabsf(window.corr[i - window.corrFirst]));
+		dropPacketWindow(window, i + 1);
+	}
+	std::nth_element(noise.begin(), noise.begin() + noise.size() / 2, noise.end());
+	double limit = options.correlation * std::max(noise[noise.size() / 2] / 0.6745, sqrt(tmplNorm));
+
+	rewindPacketWindow(window);
+	for (uint64_t i = 0; i < numCorr; )
+	{
+		dropPacketWindow(window, i);
+		if (correlatePacketWindow(window, i + length))
+		{
+			bitLength = UINT32_MAX;
+			break;
+		}
+
+		if (window.corr[i - window.corrFirst] <= limit)
+		{
+			i++;
+			continue;
+		}
+
+		// Strongest correlation within a preamble length
+		uint64_t start = i;
+		for (uint64_t j = i; j < numCorr && j < i + length; j++)
+		{
+			if (window.corr[start - window.corrFirst] < window.corr[j - window.corrFirst])
+			{
+				start = j;
+			}
+		}
+		if (fillPacketWindow(window, start + length + 1))
+		{
+			bitLength = UINT32_MAX;
+			break;
+		}
+
+		const float *x        = &window.x[start - window.xFirst];
+		double       onLevel  = 0;
+		double       offLevel = 0;
+		uint32_t     onBits   = 0;
+		uint64_t     bit      = 0;
+		uint32_t     offRun   = 0;
+
+		for (uint32_t k = 0; k < numBits; k++)
+		{
+			if (preamble[k] == '1')
+			{
+				onLevel += getBitLevel(x, 0, k, width);
+				onBits++;
+			}
+			else
+			{
+				offLevel += getBitLevel(x, 0, k, width);
+			}
+		}
+
+		double   threshold = (onLevel / onBits + offLevel / (numBits - onBits)) / 2;
+		uint32_t errors    = 0;
+
+		// Something like a lone pulse correlates but doesn't decode as the preamble
+		for (uint32_t k = 0; k < numBits; k++)
+		{
+			errors += (getBitLevel(x, 0, k, width) > threshold) != (preamble[k] == '1');
+		}
+		if (errors > numBits / PREAMBLE_ERROR_BITS)
+		{
+			i = start + 1;
+			continue;
+		}
+
+		double    peak   = window.corr[start - window.corrFirst];
+		bitWriter writer = {NULL, 0, 0};
+
+		for (; start + (uint64_t) ((bit + 1) * width + 0.5) <= count; bit++)
+		{
+			if (options.packetBits != 0 ? bit >= options.packetBits : offRun >= PREAMBLE_GAP_BITS)
+			{
+				break;
+			}
+
+			// Reading more samples can move the window's samples
+			if (fillPacketWindow(window, start + (uint64_t) ((bit + 1) * width + 0.5)))
+			{
+				bitLength = UINT32_MAX;
+				break;
+			}
+			x = &window.x[start - window.xFirst];
+
+			uint32_t on = getBitLevel(x, 0, bit, width) > threshold;
+
+			if (appendBits(writer, on, 1))
+			{
+				bitLength = UINT32_MAX;
+				break;
+			}
+			offRun = (on ? 0 : offRun + 1);
+		}
+		if (bitLength == UINT32_MAX)
+		{
+			free(writer.words);
+			break;
+		}
+		if (options.packetBits == 0)
+		{
+			// The gap isn't part of the packet (unused bits are already 0)
+			writer.bitLength -= offRun;
+		}
+		i = start + std::max((uint64_t) length, (uint64_t) (bit * width + 0.5));
+		if (options.match != NULL && !hasBits(writer, options.match))
+		{
+			free(writer.words);
+			continue;
+		}
+		numPackets++;
+		fprintf(out, "\nPacket %u at sample %" PRIu64 ": correlation %0.1f, threshold %0.1f, bits %" PRIu64 "\n",
+			numPackets, start, peak / (limit / options.correlation), threshold + mean, writer.bitLength);
+		if (printBits(writer, out))
+		{
+			free(writer.words);
+			bitLength = UINT32_MAX;
+			break;
+		}
+		bitLength += (uint32_t) writer.bitLength;
+		free(writer.words);
+		if (numPackets == options.maxMessages)
+		{
+			break;
+		}
+	}
+	delete [] window.block;
+	delete [] tmpl;
+	if (bitLength == UINT32_MAX)
+	{
+		return UINT32_MAX;
+	}
+	fprintf(out, "Packets: %u\n", numPackets);
+	return bitLength;
+}
+
+/**
+ * Gets the memory of getCounts() counts.
+ *
+ * @param fileFormat - The file format
+ * @param countShift - Low bits of samples left out of the counts
+ * @return The bytes
+ */
+uint64_t getCountsBytes(uint32_t fileFormat, uint32_t countShift)
+{
+	return ((uint64_t) sizeof(uint32_t)) << (8 * getSampleByteSize(fileFormat) - countShift);
+}
+
+/**
+ * Gets the memory of the blocks runPipeline() has in flight.
+ *
+ * @param pipelined - Each stage runs on its own thread
+ * @return The bytes
+ */
+uint64_t getBlocksBytes(uint32_t pipelined)
+{
+	return (pipelined ? PIPELINE_BLOCKS : 1) * (uint64_t) getBlockSize(1);
+}
+
+/**
+ * Estimates the memory of decodeSamples() on a stream without bursts: the counts, the span
+ * lengths, the blocks in flight and what the options add.
+ *
+ * @param fileFormat - The stream's file format
+ * @param countShift - Low bits of samples left out of the counts
+ * @param numSamples - Number of samples in the stream
+ * @param options    - The settings
+ * @return The bytes
+ */
+uint64_t getDecodeBytes(uint32_t fileFormat, uint32_t countShift, uint64_t numSamples, const decodeOptions &options)
+{
+	uint64_t spansBytes = (MAX_SPAN + 1) * sizeof(uint32_t);
+	uint64_t bytes      = getCountsBytes(fileFormat, countShift) + spansBytes + getBlocksBytes(options.pipelined);
+
+	if (options.multiThreshold)
+	{
+		// State bits, spans and span lengths per threshold
+		bytes += THRESHOLD_CANDIDATES * (getBlockSize(0) + spansBytes);
+	}
+	if (options.rectify)
+	{
+		bytes += options.rectify * sizeof(uint32_t);
+	}
+	if (options.flicker == 0)
+	{
+		// The state of each sample
+		bytes += numSamples / 8;
+	}
+	if (options.preamble != NULL)
+	{
+		// Up to 2^20 noise values and a few chunks of samples and their correlations
+		bytes += (std::min(numSamples, (uint64_t) 1 << 20) + 8 * SAMPLE_BLOCK_SIZE) * sizeof(float);
+	}
+	return bytes;
+}
+
+/**
+ * Picks how many jobs fit in --memory-limit.
+ *
+ * @param options  - The settings
+ * @param jobBytes - Memory of the biggest job
+ * @param what     - What the jobs decode
+ * @param out      - Where to output the plan
+ * @return The number of jobs or 0 if one job doesn't fit
+ */
+uint32_t planJobs(const decodeOptions &options, uint64_t jobBytes, const char *what, FILE *out)
+{
+	uint64_t fit;
+	uint32_t jobs;
+
+	if (options.memoryLimit == 0)
+	{
+		return options.jobs;
+	}
+	fit = options.memoryLimit / std::max(jobBytes, (uint64_t) 1);
+	if (fit == 0)
+	{
+		fprintf(stderr, "Error: Decoding the %s needs about %0.1f MiB, more than --memory-limit\n", what, jobBytes / 1048576.0);
+		return 0;
+	}
+	jobs = (uint32_t) std::min((uint64_t) options.jobs, fit);
+	fprintf(out, "Memory plan: %u jobs for %s, about %0.1f MiB each\n", jobs, what, jobBytes / 1048576.0);
+	return jobs;
+}
+
+/**
+ * Output of a job waiting to be released in order.
+ */
+struct reorderSlot
+{
+	std::atomic<uint64_t> ready;  // Sequence number + 1 once output is set
+	char                 *output;
+	size_t                size;
+	uint32_t              error;  // Nothing after this job is output
+};
+
+/**
+ * Releases the output of jobs in sequence order as soon as every earlier job is done. Finished
+ * jobs put their output in a ring of slots and whichever job gets the releasing flag outputs
+ * the finished jobs that are next in order. At most numSlots outputs are held.
+ */
+struct reorderBuffer
+{
+	reorderSlot            *slots;
+	uint32_t                numSlots;
+	std::atomic<uint64_t>   released;  // Sequence number of the next output
+	std::atomic<uint32_t>   releasing; // Set while a job is outputting
+	uint32_t                stopped;   // Set after an error (only used while releasing)
+	FILE                   *out;
+	std::mutex              mutex;     // Only for waiting on a free slot
+	std::condition_variable freed;
+};
+
+/**
+ * Waits until there is a free slot for a sequence number.
+ *
+ * @param buffer - The reorder buffer
+ * @param seq    - The sequence number
+ */
+void waitForSlot(reorderBuffer &buffer, uint64_t seq)
+{
+	if (seq < buffer.released + buffer.numSlots)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(buffer.mutex);
+	while (seq >= buffer.released + buffer.numSlots)
+	{
+		buffer.freed.wait(lock);
+	}
+}
+
+/**
+ * Hands over the output of a job then outputs everything that is ready in order. The job must
+ * have waited for its slot with waitForSlot().
+ *
+ * @param buffer - The reorder buffer
+ * @param seq    - The sequence number of the job
+ * @param output - The output (from malloc) which is freed once it is output
+ * @param size   - The size of the output
+ * @param error  - Non-zero if the job failed
+ */
+void releaseOutput(reorderBuffer &buffer, uint64_t seq, char *output, size_t size, uint32_t error)
+{
+	reorderSlot &slot = buffer.slots[seq % buffer.numSlots];
+
+	slot.output = output;
+	slot.size   = size;
+	slot.error  = error;
+	slot.ready  = seq + 1;
+
+	// Another job is outputting. It checks for more after it's done.
+	while (buffer.releasing.exchange(1) == 0)
+	{
+		uint64_t next  = buffer.released;
+		uint64_t start = next;
+
+		for (; buffer.slots[next % buffer.numSlots].ready == next + 1; next++)
+		{
+			reorderSlot &done = buffer.slots[next % buffer.numSlots];
+
+			if (!buffer.stopped)
+			{
+				fwrite(done.output, 1, done.size, buffer.out);
+				buffer.stopped = done.error;
+			}
+			free(done.output);
+			buffer.released = next + 1;
+		}
+		buffer.releasing = 0;
+		if (next != start)
+		{
+			std::lock_guard<std::mutex> lock(buffer.mutex);
+			buffer.freed.notify_all();
+		}
+
+		// Output that was handed over while outputting
+		if (buffer.slots[next % buffer.numSlots].ready != next + 1)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * Sets up a reorder buffer.
+ *
+ * @param buffer   - The reorder buffer
+ * @param numSlots - Max number of outputs held
+ * @param out      - Where to output
+ */
+void initReorderBuffer(reorderBuffer &buffer, uint32_t numSlots, FILE *out)
+{
+	buffer.numSlots  = numSlots;
+	buffer.slots     = new reorderSlot[numSlots];
+	buffer.released  = 0;
+	buffer.releasing = 0;
+	buffer.stopped   = 0;
+	buffer.out       = out;
+	for (uint32_t i = 0; i < numSlots; i++)
+	{
+		buffer.slots[i].ready = 0;
+	}
+}
+
+/**
+ * A range of samples with activity. Also an entry of a --write-index file.
+ */
+struct burst
+{
+	uint64_t start;       // First sample read, with the margin
+	uint64_t end;         // One past the last sample read, with the margin
+	uint64_t firstActive; // First active sample
+	uint64_t lastActive;  // One past the last active sample
+	uint64_t active;      // Number of active samples
+	uint32_t peak;        // Highest active sample
+	uint32_t mean;        // Mean of the active samples
+};
+
+/**
+ * Start of a --write-index file. Followed by the bursts. Also the start of an --archive file with
+ * its own tag.
+ */
+struct burstIndexHeader
+{
+	uint32_t tag;        // "OOKB"
+	uint32_t version;    // 1
+	uint32_t fileFormat; // Of the samples
+	uint32_t sampleRate; // 0 if unknown
+	uint64_t numSamples;
+	uint64_t numBursts;
+	uint32_t median;     // Noise floor
+	uint32_t level;      // Lowest active sample
+};
+
+/**
+ * Idle samples before a burst (or after the last one) of an --archive file. An --archive file is a
+ * burstIndexHeader, the bursts, a gap before each burst and one after the last, then the frames
+ * of each burst as they are in the file.
+ */
+struct archiveGap
+{
+	uint64_t length; // Number of samples
+	uint32_t min;    // Lowest sample
+	uint32_t max;    // Highest sample
+	uint64_t sum;    // Sum of the samples
+};
+
+/**
+ * State of findBurstsBlock() between blocks.
+ */
+struct burstContext
+{
+	std::vector<burst> *bursts;
+	uint64_t            gap;    // Max samples between activity in the same burst
+	uint64_t            sum;    // Sum of the active samples of the last burst
+};
+
+/**
+ * Merges the active samples of a block into bursts. See findBursts().
+ */
+uint32_t findBurstsBlock(const sampleBlock &block, void *context)
+{
+	burstContext       *finder = (burstContext*) context;
+	std::vector<burst> &bursts = *finder->bursts;
+	uint32_t            pos    = 0;
+
+	while (pos < block.count)
+	{
+		uint32_t state = (block.bits[pos / 64] >> (pos % 64)) & 1;
+		uint32_t run   = kernels.getRunLength(block.bits, pos, block.count);
+
+		if (state)
+		{
+			uint64_t start = block.start + pos;
+			uint32_t peak  = 0;
+			uint64_t sum   = 0;
+
+			for (uint32_t i = pos; i < pos + run; i++)
+			{
+				peak = std::max(peak, block.samples[i]);
+				sum += block.samples[i];
+			}
+			if (!bursts.empty() && start - bursts.back().lastActive <= finder->gap)
+			{
+				bursts.back().lastActive  = start + run;
+				bursts.back().active     += run;
+				bursts.back().peak        = std::max(bursts.back().peak, peak);
+				finder->sum              += sum;
+			}
+			else
+			{
+				burst active = {start, start + run, start, start + run, run, peak, 0};
+
+				bursts.push_back(active);
+				finder->sum = sum;
+			}
+			bursts.back().mean = (uint32_t) (finder->sum / bursts.back().active);
+		}
+		pos += run;
+	}
+	return 0;
+}
+
+/**
+ * Finds the median and the median absolute deviation of the samples from their counts.
+ *
+ * @param counts    - Number of times each value occurs
+ * @param numCounts - Number of values
+ * @param count     - Number of samples
+ * @param median    - Receives the median
+ * @param deviation - Receives the median absolute deviation
+ */
+void getMedianDeviation(const uint32_t *counts, uint64_t numCounts, uint32_t count, uint64_t *median, uint64_t *deviation)
+{
+	uint64_t sum = 0;
+	uint64_t i;
+
+	for (i = 0; i + 1 < numCounts; i++)
+	{
+		sum += counts[i];
+		if (2 * sum >= count)
+		{
+			break;
+		}
+	}
+	*median = i;
+
+	// Widen a window around the median until it has half the samples
+	sum = counts[i];
+	for (i = 0; 2 * sum < count; )
+	{
+		i++;
+		if (*median >= i)
+		{
+			sum += counts[*median - i];
+		}
+		if (*median + i < numCounts)
+		{
+			sum += counts[*median + i];
+		}
+	}
+	*deviation = i;
+}
+
+/**
+ * Finds bursts. A sample is active if it's more than options.burstLevel median absolute
+ * deviations above the median. Active samples no more than options.hangover samples apart are a
+ * burst. Each burst has a margin of hangover/2 samples on either side.
+ *
+ * @param bursts  - Receives the bursts
+ * @param header  - Receives the noise floor, level and number of samples (for --write-index)
+ * @param stream  - The sample stream at the start of the data
+ * @param options - The settings
+ * @return 0 on success, non-zero on error
+ */
+uint32_t findBursts(std::vector<burst> &bursts, burstIndexHeader &header, sampleStream &stream, const decodeOptions &options)
+{
+	burstContext finder    = {&bursts, options.hangover, 0};
+	uint32_t    *counts;
+	uint32_t     count;
+	uint64_t     median;
+	uint64_t     deviation;
+	size_t       numCounts = getNumCounts(stream);
+
+	// Check for size overflow
+	if (numCounts == 0)
+	{
+		fprintf(stderr, "Error: 32 bit samples requires a 64 bit binary and 16 GiB of RAM.\n");
+		return 1;
+	}
+	counts = (uint32_t*) allocLarge(numCounts * sizeof(uint32_t), LARGE_COUNTS);
+
+	// Noise floor
+	count = getCounts(counts, stream, options.pipelined);
+	if (count == UINT32_MAX)
+	{
+		freeLarge(counts, numCounts * sizeof(uint32_t));
+		return 1;
+	}
+	rewindStream(stream);
+	getMedianDeviation(counts, numCounts, count, &median, &deviation);
+	freeLarge(counts, numCounts * sizeof(uint32_t));
+
+	uint64_t level = median + (uint64_t) (options.burstLevel * std::max(deviation, (uint64_t) 1)) + 1;
+
+	if (level < numCounts)
+	{
+		if (runPipeline(stream, STAGE_THRESHOLD, (uint32_t) (level << stream.countShift), 0, findBurstsBlock, &finder, options.pipelined))
+		{
+			return 1;
+		}
+	}
+
+	// Drop noise spikes and add margins
+	size_t numBursts = 0;
+	for (size_t i = 0; i < bursts.size(); i++)
+	{
+		if (bursts[i].active >= BURST_MIN_ACTIVE)
+		{
+			burst &kept = bursts[numBursts++];
+
+			kept       = bursts[i];
+			kept.start = 0;
+			kept.end   = std::min(kept.lastActive + options.hangover / 2, (uint64_t) count);
+			if (kept.firstActive > options.hangover / 2)
+			{
+				kept.start = kept.firstActive - options.hangover / 2;
+			}
+		}
+	}
+	bursts.resize(numBursts);
+
+	header.numSamples = count;
+	header.numBursts  = numBursts;
+	header.median     = (uint32_t) median;
+	header.level      = (uint32_t) std::min(level, (uint64_t) UINT32_MAX);
+	return 0;
+}
+
+/**
+ * Writes bursts to a --write-index file.
+ *
+ * @param fileName - The output file name
+ * @param header   - The header from findBursts()
+ * @param bursts   - The bursts
+ * @return 0 on success, non-zero on error
+ */
+uint32_t writeBurstIndex(const char *fileName, const burstIndexHeader &header, const std::vector<burst> &bursts)
+{
+	FILE *fout = fopen(fileName, "wb");
+
+	if (fout == NULL)
+	{
+		perror("fopen");
+		return 1;
+	}
+	if (fwrite(&header, sizeof(burstIndexHeader), 1, fout) != 1 ||
+	    (!bursts.empty() && fwrite(bursts.data(), sizeof(burst), bursts.size(), fout) != bursts.size()))
+	{
+		perror("fwrite");
+		fclose(fout);
+		return 1;
+	}
+	if (fclose(fout))
+	{
+		perror("fclose");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Reads bursts from a --write-index file and checks it's of the same samples.
+ *
+ * @param fileName   - The index file name
+ * @param bursts     - Receives the bursts
+ * @param header     - Receives the header
+ * @param stream     - The sample stream the index should be of
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @return 0 on success, non-zero on error
+ */
+uint32_t readBurstIndex(const char *fileName, std::vector<burst> &bursts, burstIndexHeader &header, sampleStream &stream, uint32_t sampleRate)
+{
+	FILE    *fin        = fopen(fileName, "rb");
+	uint64_t numSamples = stream.memorySize;
+
+	if (fin == NULL)
+	{
+		perror("fopen");
+		return 1;
+	}
+	if (stream.files != NULL)
+	{
+		numSamples = 0;
+		for (uint32_t i = 0; i < stream.numFiles; i++)
+		{
+			numSamples += stream.files[i].numSamples;
+		}
+	}
+	else if (stream.fin != NULL)
+	{
+		uint64_t frameSize = (uint64_t) getSampleByteSize(stream.fileFormat) * (((stream.fileFormat >> 2) & 0xff) + 1);
+
+		fseek(stream.fin, 0, SEEK_END);
+		numSamples = ((uint64_t) ftell(stream.fin) - stream.startOffset) / frameSize;
+		rewindStream(stream);
+	}
+	if (fread(&header, sizeof(burstIndexHeader), 1, fin) != 1 ||
+	    header.tag     != BURST_INDEX_TAG ||
+	    header.version != BURST_INDEX_VERSION)
+	{
+		fprintf(stderr, "Error: \"%s\" isn't an index file\n", fileName);
+		fclose(fin);
+		return 1;
+	}
+	if (header.fileFormat != stream.fileFormat ||
+	    header.sampleRate != sampleRate        ||
+	    header.numSamples != numSamples)
+	{
+		fprintf(stderr, "Error: \"%s\" is an index of a different file\n", fileName);
+		fclose(fin);
+		return 1;
+	}
+	bursts.resize(header.numBursts);
+	if (header.numBursts != 0 && fread(bursts.data(), sizeof(burst), bursts.size(), fin) != bursts.size())
+	{
+		fprintf(stderr, "Error: \"%s\" is truncated\n", fileName);
+		fclose(fin);
+		return 1;
+	}
+	fclose(fin);
+	return 0;
+}
+
+/**
+ * The bursts being decoded by decodeBurstJobs().
+ */
+struct burstJobs
+{
+	const decodeOptions      *options;
+	const std::vector<burst> *bursts;
+	const uint64_t           *readAt;    // Sample of the stream each burst starts at or NULL for its start
+	sampleStream             *stream;
+	std::mutex                reading;   // Only one job reads the stream at a time
+	uint32_t                  sampleRate;
+	std::atomic<uint64_t>     next;      // Next burst to decode
+	std::atomic<uint32_t>     error;
+	std::atomic<uint64_t>     bitLength;
+	reorderBuffer             buffer;
+};
+
+/**
+ * Reads a burst and normalizes it to 16 bit unsigned from its min to its max before outputting
+ * its data.
+ *
+ * @param out    - Where to output
+ * @param number - The burst number
+ * @param area   - The burst
+ * @param jobs   - The bursts
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeBurst(FILE *out, uint32_t number, const burst &area, burstJobs &jobs)
+{
+	if (area.end - area.start > UINT32_MAX)
+	{
+		fprintf(stderr, "Error: Burst %u is too long\n", number);
+		return 1;
+	}
+
+	uint32_t  numSamples = (uint32_t) (area.end - area.start);
+	uint32_t *samples    = (uint32_t*) allocLarge(numSamples * sizeof(uint32_t), LARGE_SAMPLES);
+	uint32_t  error;
+	uint32_t  readError;
+
+	{
+		std::lock_guard<std::mutex> lock(jobs.reading);
+
+		readError = seekStream(*jobs.stream, jobs.readAt != NULL ? jobs.readAt[number - 1] : area.start) ||
+		            getSamples(samples, numSamples, *jobs.stream, &error) != numSamples;
+	}
+	if (readError)
+	{
+		// The samples are freed after the lock so other jobs can read meanwhile
+		fprintf(stderr, "Error: Reading burst %u\n", number);
+		freeLarge(samples, numSamples * sizeof(uint32_t));
+		return 1;
+	}
+
+	// Normalize to 16 bit unsigned
+	uint32_t floor = UINT32_MAX;
+	uint32_t peak  = 0;
+
+	for (uint32_t i = 0; i < numSamples; i++)
+	{
+		floor = std::min(floor, samples[i]);
+		peak  = std::max(peak,  samples[i]);
+	}
+	for (uint32_t i = 0; i < numSamples; i++)
+	{
+		samples[i] = (uint32_t) ((uint64_t) (samples[i] - floor) * 65535 / std::max(peak - floor, (uint32_t) 1));
+	}
+	fprintf(out, "\nBurst %u: samples %" PRIu64 "-%" PRIu64 ", floor %u, peak %u\n", number, area.firstActive, area.lastActive, floor, peak);
+
+	sampleStream burstStream = makeMemoryStream(samples, numSamples, makeFileFormat(2, 1, 0, 0, 1));
+	uint32_t     burstBits;
+
+	if (jobs.options->preamble != NULL)
+	{
+		burstBits = findPackets(burstStream, jobs.sampleRate, *jobs.options, out);
+	}
+	else
+	{
+		burstBits = decodeStream(burstStream, jobs.sampleRate, *jobs.options, out);
+	}
+	if (burstBits != UINT32_MAX)
+	{
+		jobs.bitLength += burstBits;
+	}
+	freeLarge(samples, numSamples * sizeof(uint32_t));
+	return 0;
+}
+
+/**
+ * Decodes bursts until there are none left. Output is released in burst order.
+ *
+ * @param jobs - The bursts
+ */
+void decodeBurstJobs(burstJobs *jobs)
+{
+	while (!jobs->error)
+	{
+		uint64_t i = jobs->next++;
+		char    *output;
+		size_t   size;
+		uint32_t error;
+
+		if (i >= jobs->bursts->size())
+		{
+			break;
+		}
+		waitForSlot(jobs->buffer, i);
+
+		FILE *out = open_memstream(&output, &size);
+		if (out == NULL)
+		{
+			perror("open_memstream");
+			output = NULL;
+			size   = 0;
+			error  = 1;
+		}
+		else
+		{
+			error = decodeBurst(out, (uint32_t) i + 1, (*jobs->bursts)[i], *jobs);
+			fclose(out);
+		}
+		if (error)
+		{
+			jobs->error = 1;
+		}
+		releaseOutput(jobs->buffer, i, output, size, error);
+	}
+}
+
+/**
+ * Turns a time into a sample number. Times are seconds, [H:]M:S or a sample number ending in "s".
+ *
+ * @param text       - The time
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param sample     - Receives the sample number
+ * @return 0 on success, non-zero on error
+ */
+uint32_t parseTime(const char *text, uint32_t sampleRate, uint64_t *sample)
+{
+	const char *pos     = text;
+	double      seconds = 0;
+	char       *end;
+
+	if (strspn(text, "0123456789") != 0 && strcmp(text + strspn(text, "0123456789"), "s") == 0)
+	{
+		*sample = strtoull(text, NULL, 10);
+		return 0;
+	}
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		double value = strtod(pos, &end);
+
+		if (end == pos || !(value >= 0))
+		{
+			break;
+		}
+		seconds = 60 * seconds + value;
+		if (*end == 0)
+		{
+			if (sampleRate == 0)
+			{
+				fprintf(stderr, "Error: \"%s\" is a time but the sample rate isn't known (use a sample number like 1000s)\n", text);
+				return 1;
+			}
+			*sample = (uint64_t) (seconds * sampleRate + 0.5);
+			return 0;
+		}
+		if (*end != ':')
+		{
+			break;
+		}
+		pos = end + 1;
+	}
+	fprintf(stderr, "Error: \"%s\" isn't seconds, [H:]M:S or a sample number ending in \"s\"\n", text);
+	return 1;
+}
+
+/**
+ * Copies frames of a sample stream's file(s) as they are in the file.
+ *
+ * @param stream    - The sample stream (of files)
+ * @param sample    - The first sample
+ * @param numFrames - Number of frames to copy
+ * @param fout      - Where to copy them
+ * @return The number of frames copied, less than numFrames at the end of the stream, or UINT64_MAX on error
+ */
+uint64_t copyFrames(sampleStream &stream, uint64_t sample, uint64_t numFrames, FILE *fout)
+{
+	uint8_t  raw[65536];
+	uint32_t frameSize = getSampleByteSize(stream.fileFormat) * (((stream.fileFormat >> 2) & 0xff) + 1);
+	uint64_t count     = 0;
+
+	if (seekStream(stream, sample))
+	{
+		return UINT64_MAX;
+	}
+	while (count < numFrames)
+	{
+		size_t want = (size_t) std::min(numFrames - count, (uint64_t) (sizeof(raw) / frameSize));
+		size_t got  = fread(raw, frameSize, want, stream.fin);
+
+		if (got != 0 && fwrite(raw, frameSize, got, fout) != got)
+		{
+			perror("fwrite");
+			return UINT64_MAX;
+		}
+		count += got;
+		if (got < want)
+		{
+			if (ferror(stream.fin))
+			{
+				perror("fread");
+				return UINT64_MAX;
+			}
+			if (stream.files == NULL || stream.file + 1 >= stream.numFiles)
+			{
+				break;
+			}
+
+			// Next file
+			setStreamFile(stream, stream.file + 1);
+			if (fseek(stream.fin, (long) stream.startOffset, SEEK_SET))
+			{
+				perror("fseek");
+				return UINT64_MAX;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * Writes each burst to its own .wav file in --extract DIR in the file's sample format. Files are
+ * named by the burst's first sample in the file. Bursts keep their margins unless --padding is
+ * set, then they are padded from their first and last active samples.
+ *
+ * @param bursts     - The bursts
+ * @param stream     - The sample stream (of files)
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress
+ * @return 0 on success, non-zero on error
+ */
+uint32_t extractBursts(const std::vector<burst> &bursts, sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	uint32_t channels  = ((stream.fileFormat >> 2) & 0xff) + 1;
+	uint32_t frameSize = getSampleByteSize(stream.fileFormat) * channels;
+	uint64_t before    = 0;
+	uint64_t after     = 0;
+
+	if (stream.fin == NULL)
+	{
+		fprintf(stderr, "Error: --extract copies the file's samples, not demodulated ones\n");
+		return 1;
+	}
+	if (sampleRate == 0)
+	{
+		fprintf(stderr, "Error: --extract needs the sample rate for the .wav files (use --sample-rate)\n");
+		return 1;
+	}
+	if (options.padding != NULL)
+	{
+		std::string padding = options.padding;
+		size_t      comma   = padding.find(',');
+
+		if (parseTime(padding.substr(0, comma).c_str(), sampleRate, &before) ||
+		    parseTime(comma == std::string::npos ? padding.c_str() : padding.c_str() + comma + 1, sampleRate, &after))
+		{
+			return 1;
+		}
+	}
+	for (size_t i = 0; i < bursts.size(); i++)
+	{
+		uint64_t first = bursts[i].start;
+		uint64_t last  = bursts[i].end;
+
+		if (options.padding != NULL)
+		{
+			first = bursts[i].firstActive - std::min(bursts[i].firstActive, before);
+			last  = bursts[i].lastActive + after;
+		}
+		if (stream.limit != 0)
+		{
+			last = std::min(last, stream.limit);
+		}
+
+		char  name[4096];
+		FILE *fout;
+
+		snprintf(name, sizeof(name), "%s/burst-%012" PRIu64 ".wav", options.extract, options.windowStart + first);
+		fout = fopen(name, "wb");
+		if (fout == NULL)
+		{
+			perror("fopen");
+			return 1;
+		}
+
+		// The sizes are written once the frames are copied
+		wavHeader header;
+		uint64_t  numFrames;
+
+		header.tag            = 0x46464952; // "RIFF"
+		header.fileSize       = sizeof(wavHeader) - 8;
+		header.type           = 0x45564157; // "WAVE"
+		header.chunkMarker    = 0x20746d66; // "fmt "
+		header.fileSizeSoFar  = 16;
+		header.format         = 1; // PCM
+		header.channels       = (uint16_t) channels;
+		header.sampleRate     = sampleRate;
+		header.byteRate       = sampleRate * frameSize;
+		header.bytesPerSample = (uint16_t) frameSize;
+		header.bitsPerSample  = (uint16_t) (8 * getSampleByteSize(stream.fileFormat));
+		header.dataTag        = 0x61746164; // "data"
+		header.dataSize       = 0;
+		if (fwrite(&header, sizeof(wavHeader), 1, fout) != 1)
+		{
+			perror("fwrite");
+			fclose(fout);
+			return 1;
+		}
+		numFrames = copyFrames(stream, first, last - first, fout);
+		if (numFrames == UINT64_MAX)
+		{
+			fclose(fout);
+			return 1;
+		}
+		header.dataSize = (uint32_t) (numFrames * frameSize);
+		header.fileSize = header.dataSize + sizeof(wavHeader) - 8;
+		if (fseek(fout, 0, SEEK_SET) || fwrite(&header, sizeof(wavHeader), 1, fout) != 1 || fclose(fout))
+		{
+			perror("fwrite");
+			return 1;
+		}
+	}
+	fprintf(out, "Extracted %u bursts to %s\n", (uint32_t) bursts.size(), options.extract);
+	return 0;
+}
+
+/**
+ * Writes an --archive file of a sample stream. Bursts are kept as the frames in the file and the
+ * idle samples between them as their length and levels.
+ *
+ * @param fileName - The output file name
+ * @param header   - The header from findBursts() or readBurstIndex()
+ * @param bursts   - The bursts
+ * @param stream   - The sample stream (of files)
+ * @param out      - Where to output progress
+ * @return 0 on success, non-zero on error
+ */
+uint32_t writeArchive(const char *fileName, const burstIndexHeader &header, const std::vector<burst> &bursts, sampleStream &stream, FILE *out)
+{
+	burstIndexHeader        archive  = header;
+	std::vector<archiveGap> gaps(bursts.size() + 1);
+	uint64_t                position = 0;
+	uint64_t                kept     = 0;
+	FILE                   *fout;
+
+	if (stream.fin == NULL)
+	{
+		fprintf(stderr, "Error: --archive keeps the file's samples, not demodulated ones\n");
+		return 1;
+	}
+	fout = fopen(fileName, "wb");
+	if (fout == NULL)
+	{
+		perror("fopen");
+		return 1;
+	}
+
+	// The gaps are written once they are measured
+	archive.tag     = ARCHIVE_TAG;
+	archive.version = ARCHIVE_VERSION;
+	if (fwrite(&archive, sizeof(burstIndexHeader), 1, fout) != 1 ||
+	    (!bursts.empty() && fwrite(bursts.data(), sizeof(burst), bursts.size(), fout) != bursts.size()) ||
+	    fwrite(gaps.data(), sizeof(archiveGap), gaps.size(), fout) != gaps.size())
+	{
+		perror("fwrite");
+		fclose(fout);
+		return 1;
+	}
+	for (size_t i = 0; i <= bursts.size(); i++)
+	{
+		uint64_t    end = i < bursts.size() ? bursts[i].start : header.numSamples;
+		archiveGap &gap = gaps[i];
+		uint32_t    samples[16384];
+		uint32_t    error;
+
+		gap.length = end > position ? end - position : 0;
+		gap.min    = gap.length != 0 ? UINT32_MAX : 0;
+		gap.max    = 0;
+		gap.sum    = 0;
+		if (gap.length != 0 && seekStream(stream, position))
+		{
+			fclose(fout);
+			return 1;
+		}
+		for (uint64_t done = 0; done < gap.length;)
+		{
+			uint32_t want = (uint32_t) std::min(gap.length - done, (uint64_t) (sizeof(samples) / sizeof(uint32_t)));
+			uint32_t got  = getSamples(samples, want, stream, &error);
+
+			for (uint32_t j = 0; j < got; j++)
+			{
+				gap.min  = std::min(gap.min, samples[j]);
+				gap.max  = std::max(gap.max, samples[j]);
+				gap.sum += samples[j];
+			}
+			done += got;
+			if (got < want)
+			{
+				fprintf(stderr, "Error: Reading the samples before burst %u\n", (uint32_t) i + 1);
+				fclose(fout);
+				return 1;
+			}
+		}
+		if (i < bursts.size())
+		{
+			uint64_t length = bursts[i].end - bursts[i].start;
+
+			if (copyFrames(stream, bursts[i].start, length, fout) != length)
+			{
+				fprintf(stderr, "Error: Reading burst %u\n", (uint32_t) i + 1);
+				fclose(fout);
+				return 1;
+			}
+			kept    += length;
+			position = std::max(position, bursts[i].end);
+		}
+	}
+	if (fseek(fout, (long) (sizeof(burstIndexHeader) + bursts.size() * sizeof(burst)), SEEK_SET) ||
+	    fwrite(gaps.data(), sizeof(archiveGap), gaps.size(), fout) != gaps.size() ||
+	    fclose(fout))
+	{
+		perror("fwrite");
+		return 1;
+	}
+	rewindStream(stream);
+	fprintf(out, "Archived %u bursts, %" PRIu64 " of %" PRIu64 " samples (%0.2f%%), to %s\n",
+		(uint32_t) bursts.size(), kept, header.numSamples, 100.0 * kept / std::max(header.numSamples, (uint64_t) 1), fileName);
+	return 0;
+}
+
+/**
+ * Decodes bursts options.jobs at a time.
+ *
+ * @param bursts     - The bursts
+ * @param readAt     - Sample of the stream each burst starts at or NULL for their start
+ * @param stream     - The sample stream
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress and the data
+ * @return The total bit length of the bursts or UINT32_MAX on error
+ */
+uint32_t decodeBurstList(const std::vector<burst> &bursts, const uint64_t *readAt, sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	burstJobs jobs;
+
+	// A job holds its burst's samples while decoding them as 16 bit samples
+	uint64_t maxLength = 0;
+	uint32_t numJobs;
+
+	for (size_t i = 0; i < bursts.size(); i++)
+	{
+		maxLength = std::max(maxLength, bursts[i].end - bursts[i].start);
+	}
+	numJobs = planJobs(options, maxLength * sizeof(uint32_t) + getDecodeBytes(makeFileFormat(2, 1, 0, 0, 1), 0, maxLength, options), "bursts", out);
+	if (numJobs == 0)
+	{
+		return UINT32_MAX;
+	}
+	fflush(out);
+
+	jobs.options    = &options;
+	jobs.bursts     = &bursts;
+	jobs.readAt     = readAt;
+	jobs.stream     = &stream;
+	jobs.sampleRate = sampleRate;
+	jobs.next       = 0;
+	jobs.error      = 0;
+	jobs.bitLength  = 0;
+	initReorderBuffer(jobs.buffer, 2 * numJobs, out);
+
+	// Bursts of a --spectrogram region are already decoded a region per job
+	if (numJobs <= 1 || stream.fin == NULL)
+	{
+		decodeBurstJobs(&jobs);
+	}
+	else
+	{
+		std::vector<std::thread> threads;
+
+		for (uint32_t i = 0; i < numJobs; i++)
+		{
+			threads.push_back(std::thread(decodeBurstJobs, &jobs));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+	}
+	delete [] jobs.buffer.slots;
+	if (jobs.error)
+	{
+		return UINT32_MAX;
+	}
+	return (uint32_t) std::min((uint64_t) jobs.bitLength, (uint64_t) UINT32_MAX - 1);
+}
+
+/**
+ * Finds bursts (or reads them from --index) then normalizes each to its own floor and peak
+ * before outputting its data. This decodes weak and strong devices in the same file. Bursts of a
+ * file are decoded options.jobs at a time.
+ *
+ * @param stream     - The sample stream at the start of the data
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress and the data
+ * @return The total bit length of the bursts or UINT32_MAX on error
+ */
+uint32_t decodeBursts(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	std::vector<burst> bursts;
+	burstIndexHeader   header = {BURST_INDEX_TAG, BURST_INDEX_VERSION, stream.fileFormat, sampleRate, 0, 0, 0, 0};
+
+	if (options.readIndex != NULL)
+	{
+		fprintf(out, "Reading bursts...\n");
+		if (readBurstIndex(options.readIndex, bursts, header, stream, sampleRate))
+		{
+			return UINT32_MAX;
+		}
+	}
+	else
+	{
+		fprintf(out, "Finding bursts...\n");
+		if (findBursts(bursts, header, stream, options))
+		{
+			return UINT32_MAX;
+		}
+		if (options.writeIndex != NULL && writeBurstIndex(options.writeIndex, header, bursts))
+		{
+			return UINT32_MAX;
+		}
+	}
+	fprintf(out, "Bursts: %u\n", (uint32_t) bursts.size());
+	if (options.archive != NULL && writeArchive(options.archive, header, bursts, stream, out))
+	{
+		return UINT32_MAX;
+	}
+	if (options.extract != NULL && extractBursts(bursts, stream, sampleRate, options, out))
+	{
+		return UINT32_MAX;
+	}
+
+	return decodeBurstList(bursts, NULL, stream, sampleRate, options, out);
+}
+
+/**
+ * A setting tried by --tune and how well it measures.
+ */
+struct tuneCandidate
+{
+	uint32_t window;    // Rectify window or 0 without --rectify
+	double   level;     // Where the threshold is in the on/off range
+	uint32_t threshold;
+	uint32_t flicker;
+	uint32_t width;     // Samples per bit or 0 if none
+	double   error;     // From getBitWidthError()
+	uint64_t bits;
+	uint32_t matches;   // Messages with the --match bits
+};
+
+/**
+ * The candidates being measured by tuneJob(). Candidates are in groups of TUNE_FLICKERS with the
+ * same window and threshold.
+ */
+struct tuneJobs
+{
+	const decodeOptions        *options;
+	const uint32_t             *samples;
+	uint64_t                    numSamples;
+	uint32_t                    fileFormat;
+	uint32_t                    countShift;
+	std::vector<tuneCandidate> *candidates;
+	std::atomic<uint32_t>       next;       // Next group
+	std::atomic<uint32_t>       error;
+};
+
+/**
+ * Measures groups of candidates until there are none left. Each group thresholds the excerpt once
+ * and counts the spans of each flicker from the states kept.
+ *
+ * @param jobs - The candidates
+ */
+void tuneJob(tuneJobs *jobs)
+{
+	size_t    bitmapBytes = ((size_t) jobs->numSamples + 63) / 64 * sizeof(uint64_t);
+	uint64_t *bitmap      = (uint64_t*) allocLarge(bitmapBytes, LARGE_SAMPLES);
+	uint32_t *spans       = new uint32_t[MAX_SPAN + 1];
+	FILE     *sink        = NULL;
+
+	if (jobs->options->match != NULL)
+	{
+		// Only the number of messages is kept
+		sink = fopen("/dev/null", "w");
+		if (sink == NULL)
+		{
+			perror("fopen");
+			jobs->error = 1;
+		}
+	}
+	while (!jobs->error)
+	{
+		uint32_t group = jobs->next++;
+
+		if ((size_t) group * TUNE_FLICKERS >= jobs->candidates->size())
+		{
+			break;
+		}
+
+		tuneCandidate *candidates = jobs->candidates->data() + (size_t) group * TUNE_FLICKERS;
+		sampleStream   stream     = makeMemoryStream(jobs->samples, jobs->numSamples, jobs->fileFormat);
+
+		if (candidates[0].threshold == 0)
+		{
+			// No on/off range with this window
+			continue;
+		}
+		stream.countShift = jobs->countShift;
+		if (candidates[0].window != 0)
+		{
+			stream.rectify = makeRectifier(candidates[0].window, jobs->fileFormat);
+		}
+		if (getSpans(spans, MAX_SPAN, candidates[0].threshold, RADIO_FLICKER, stream, 0, bitmap) == UINT32_MAX)
+		{
+			jobs->error = 1;
+		}
+		if (stream.rectify != NULL)
+		{
+			freeRectifier(stream.rectify);
+		}
+		for (uint32_t i = 0; i < TUNE_FLICKERS && !jobs->error; i++)
+		{
+			tuneCandidate &candidate = candidates[i];
+			uint32_t       maxSpan   = std::min(getBitmapSpans(spans, MAX_SPAN, candidate.flicker, bitmap, jobs->numSamples), (uint32_t) MAX_SPAN);
+
+			candidate.width = findSingleBitWidth(spans, maxSpan);
+			if (candidate.width == 0 || 2 * candidate.flicker >= candidate.width)
+			{
+				candidate.width = 0;
+				continue;
+			}
+			candidate.error = getBitWidthError(spans, maxSpan, candidate.width, &candidate.bits);
+			if (sink != NULL)
+			{
+				messageFilter  filter  = {0, jobs->options->match, 0, 0, 0};
+				messageContext message = {candidate.width, {NULL, 0, 0}, NULL, &filter, sink};
+
+				if (runBitmapSpans(bitmap, jobs->numSamples, candidate.flicker, printBlock, &message) == 1 ||
+				    (message.writer.bitLength != 0 && finishMessage(filter, message.writer, sink) == 1))
+				{
+					jobs->error = 1;
+				}
+				candidate.matches = filter.numMessages;
+				free(message.writer.words);
+			}
+		}
+	}
+	if (sink != NULL)
+	{
+		fclose(sink);
+	}
+	delete [] spans;
+	freeLarge(bitmap, bitmapBytes);
+}
+
+/**
+ * Tries a grid of settings on an excerpt of the samples (--start and --end, --prefix or the first
+ * TUNE_MAX_SAMPLES) and outputs the best as options to decode with. The grid is TUNE_LEVELS
+ * threshold levels, TUNE_FLICKERS flickers and with --rectify half, the same and double the
+ * window. Candidates are measured options.jobs at a time (a job per core without --jobs). The
+ * best candidate is the one whose spans fit its bit width best (see isBetterFit()). With --match
+ * only the candidates with the most messages with those bits are considered.
+ *
+ * @param stream     - The sample stream at the start of the data
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress and the profile
+ * @return 0 on success or UINT32_MAX on error
+ */
+uint32_t tuneSamples(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	uint64_t limit = stream.limit != 0 ? stream.limit : TUNE_MAX_SAMPLES;
+
+	if (options.prefix > 0)
+	{
+		limit = std::min(limit, std::max((uint64_t) (options.prefix * (sampleRate != 0 ? sampleRate : 1)), (uint64_t) 1));
+	}
+	limit = std::min(limit, (uint64_t) TUNE_MAX_SAMPLES);
+
+	// Read the excerpt without --rectify, each window has its own
+	uint32_t  *samples    = (uint32_t*) allocLarge((size_t) limit * sizeof(uint32_t), LARGE_SAMPLES);
+	rectifier *rect       = stream.rectify;
+	uint64_t   numSamples = 0;
+	uint32_t   error      = 0;
+
+	stream.rectify = NULL;
+	while (numSamples < limit && !stream.eof && !error)
+	{
+		numSamples += getSamples(samples + numSamples, (uint32_t) std::min(limit - numSamples, (uint64_t) SAMPLE_BLOCK_SIZE), stream, &error);
+	}
+	stream.rectify = rect;
+	if (error)
+	{
+		freeLarge(samples, (size_t) limit * sizeof(uint32_t));
+		return UINT32_MAX;
+	}
+	fprintf(out, "Tuning on %" PRIu64 " samples...\n", numSamples);
+
+	// The grid
+	std::vector<tuneCandidate> candidates;
+	uint32_t                   windows[3] = {0, 0, 0};
+	uint32_t                   numWindows = 1;
+	size_t                     numCounts  = getNumCounts(stream);
+	uint32_t                  *counts     = (uint32_t*) allocLarge(numCounts * sizeof(uint32_t), LARGE_COUNTS);
+
+	if (options.rectify)
+	{
+		windows[0] = std::max(options.rectify / 2, (uint32_t) 1);
+		windows[1] = options.rectify;
+		windows[2] = std::min(options.rectify * 2, (uint32_t) 65536);
+		numWindows = 3;
+	}
+	for (uint32_t i = 0; i < numWindows; i++)
+	{
+		sampleStream excerpt = makeMemoryStream(samples, numSamples, stream.fileFormat);
+		uint32_t     count;
+		uint32_t     lo;
+		uint32_t     hi;
+
+		excerpt.countShift = stream.countShift;
+		if (windows[i] != 0)
+		{
+			excerpt.rectify = makeRectifier(windows[i], stream.fileFormat);
+		}
+		count = getCounts(counts, excerpt, 0);
+		if (excerpt.rectify != NULL)
+		{
+			freeRectifier(excerpt.rectify);
+		}
+		if (count == UINT32_MAX || findOnOffRange(counts, count, stream.fileFormat, stream.countShift, &lo, &hi))
+		{
+			lo = 0;
+			hi = 0;
+		}
+		for (uint32_t j = 0; j < TUNE_LEVELS; j++)
+		{
+			uint32_t flicker     = 1;
+			uint32_t nextFlicker = 2;
+
+			for (uint32_t k = 0; k < TUNE_FLICKERS; k++)
+			{
+				tuneCandidate candidate = {windows[i], (j + 1.0) / (TUNE_LEVELS + 1), 0, flicker, 0, 0, 0, 0};
+
+				if (hi != 0)
+				{
+					candidate.threshold = lo + (uint32_t) ((hi - lo) * candidate.level);
+				}
+				candidates.push_back(candidate);
+
+				// 1, 2, 3, 5, 8, 13...
+				uint32_t sum = flicker + nextFlicker;
+
+				flicker     = nextFlicker;
+				nextFlicker = sum;
+			}
+		}
+	}
+	freeLarge(counts, numCounts * sizeof(uint32_t));
+
+	// A job thresholds the excerpt and keeps its spans and states
+	uint32_t numJobs;
+	tuneJobs jobs;
+
+	numJobs = planJobs(options, numSamples / 8 + (MAX_SPAN + 1) * sizeof(uint32_t) + getBlocksBytes(0), "tuning", out);
+	if (numJobs == 0)
+	{
+		freeLarge(samples, (size_t) limit * sizeof(uint32_t));
+		return UINT32_MAX;
+	}
+	numJobs = std::min(numJobs, (uint32_t) (candidates.size() / TUNE_FLICKERS));
+	fprintf(out, "Trying %u settings with %u jobs...\n", (uint32_t) candidates.size(), numJobs);
+	fflush(out);
+
+	jobs.options    = &options;
+	jobs.samples    = samples;
+	jobs.numSamples = numSamples;
+	jobs.fileFormat = stream.fileFormat;
+	jobs.countShift = stream.countShift;
+	jobs.candidates = &candidates;
+	jobs.next       = 0;
+	jobs.error      = 0;
+	{
+		std::vector<std::thread> threads;
+
+		for (uint32_t i = 0; i < numJobs; i++)
+		{
+			threads.push_back(std::thread(tuneJob, &jobs));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+	}
+	freeLarge(samples, (size_t) limit * sizeof(uint32_t));
+	if (jobs.error)
+	{
+		return UINT32_MAX;
+	}
+
+	// Fewer bits than THRESHOLD_MIN_BITS fit any bit width
+	size_t best = candidates.size();
+
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		const tuneCandidate &candidate = candidates[i];
+
+		if (candidate.width == 0 || candidate.bits < THRESHOLD_MIN_BITS)
+		{
+			continue;
+		}
+		if (best == candidates.size() ||
+		    candidates[best].matches < candidate.matches ||
+		    (candidates[best].matches == candidate.matches && isBetterFit(candidate.error, candidate.bits, candidates[best].error, candidates[best].bits)))
+		{
+			best = i;
+		}
+	}
+	if (best == candidates.size())
+	{
+		fprintf(out, "No setting measures a bit width\n");
+		return 0;
+	}
+
+	const tuneCandidate &tuned = candidates[best];
+
+	fprintf(out, "threshold %u, flicker %u", tuned.threshold, tuned.flicker);
+	if (tuned.window != 0)
+	{
+		fprintf(out, ", rectify window %u", tuned.window);
+	}
+	fprintf(out, ": samples/bit %u, error %0.6f, bits %" PRIu64, tuned.width, tuned.error, tuned.bits);
+	if (options.match != NULL)
+	{
+		fprintf(out, ", matches %u", tuned.matches);
+	}
+	fprintf(out, "\nProfile: --threshold-level %g --flicker %u", tuned.level, tuned.flicker);
+	if (tuned.window != 0)
+	{
+		fprintf(out, " --rectify-window %u", tuned.window);
+	}
+	fprintf(out, "\n");
+	return 0;
+}
+
+/**
+ * Outputs the data of a sample stream. Uses tuneSamples() with --tune, decodeBursts() with
+ * --bursts, findPackets() if there's a preamble otherwise decodeStream().
+ *
+ * @param stream     - The sample stream at the start of the data
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress and the data
+ * @return The bit length of the data or UINT32_MAX on error
+ */
+uint32_t decodeSamples(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	if (options.tune)
+	{
+		return tuneSamples(stream, sampleRate, options, out);
+	}
+	if (options.bursts)
+	{
+		return decodeBursts(stream, sampleRate, options, out);
+	}
+	if (options.preamble != NULL)
+	{
+		return findPackets(stream, sampleRate, options, out);
+	}
+	return decodeStream(stream, sampleRate, options, out);
+}
+
+/**
+ * A range of frequency bins and samples that contains activity.
+ */
+struct activeRegion
+{
+	uint32_t binLo;   // Lowest active bin (bin fftSize/2 is 0 Hz)
+	uint32_t binHi;   // Highest active bin
+	uint32_t binPeak; // Bin with the most power
+	uint64_t start;   // First sample
+	uint64_t end;     // One past the last sample
+	double   power;   // Sum of the active power in binPeak
+	uint32_t frames;  // Number of active frames in binPeak
+};
+
+/**
+ * Orders regions by bin then start.
+ */
+bool compareRegionBins(const activeRegion &a, const activeRegion &b)
+{
+	if (a.binLo != b.binLo)
+	{
+		return a.binLo < b.binLo;
+	}
+	return a.start < b.start;
+}
+
+/**
+ * Orders regions by start then bin.
+ */
+bool compareRegionStarts(const activeRegion &a, const activeRegion &b)
+{
+	if (a.start != b.start)
+	{
+		return a.start < b.start;
+	}
+	return a.binLo < b.binLo;
+}
+
+/**
+ * Gets the power spectrum of a frame of I/Q samples.
+ *
+ * @param power  - Receives plan.size values with bin plan.size/2 being 0 Hz
+ * @param plan   - The FFT plan
+ * @param window - The window function (plan.size values)
+ * @param re     - The in-phase values (overwritten)
+ * @param im     - The quadrature values (overwritten)
+ */
+void getPowerSpectrum(float *power, const fftPlan &plan, const float *window, float *re, float *im)
+{
+	uint32_t size = plan.size;
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		re[i] *= window[i];
+		im[i] *= window[i];
+	}
+	fft(plan, re, im);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		uint32_t bin = (i + size / 2) & (size - 1);
+
+		power[bin] = re[i] * re[i] + im[i] * im[i];
+	}
+}
+
+/**
+ * Finds the frequency bins and time ranges that contain bursts with a short-time FFT power scan.
+ * The noise floor of each bin is the median power of up to SPECTROGRAM_FLOOR_FRAMES frames.
+ * Bins more than activityDb above their noise floor are active. Active bins that are adjacent
+ * or no more than hangover samples apart are merged into a region. Regions more than splatterDb
+ * weaker than a region at the same time are dropped.
+ *
+ * @param regions     - Receives the regions sorted by start
+ * @param options     - The settings (fftSize, activityDb, splatterDb and hangover)
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of I/Q samples in fin
+ * @return The number of regions or UINT32_MAX on error
+ */
+uint32_t scanSpectrogram(std::vector<activeRegion> &regions, const decodeOptions &options, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples)
+{
+	uint32_t  fftSize        = options.fftSize;
+	double    splatterDb     = options.splatterDb;
+	uint64_t  numFrames      = numSamples / fftSize;
+	uint64_t  floorStride    = numFrames / SPECTROGRAM_FLOOR_FRAMES + 1;
+	uint32_t  numFloorFrames = (uint32_t) ((numFrames + floorStride - 1) / floorStride);
+	uint64_t  frameBytes     = (uint64_t) getSampleByteSize(fileFormat) * (((fileFormat >> 2) & 0xff) + 1);
+	uint64_t  hangoverFrames = options.hangover / fftSize + 1;
+	float     factor         = (float) pow(10.0, options.activityDb / 10);
+	fftPlan   plan           = makeFftPlan(fftSize);
+	float    *window         = new float[fftSize];
+	float    *re             = new float[fftSize];
+	float    *im             = new float[fftSize];
+	float    *power          = new float[fftSize];
+	float    *floorPowers    = new float[(size_t) fftSize * numFloorFrames + 1];
+	float    *noiseFloor     = new float[fftSize];
+	std::vector<activeRegion> intervals;
+	activeRegion *open       = new activeRegion[fftSize];
+	uint32_t  error          = 0;
+
+	regions.clear();
+	for (uint32_t i = 0; i < fftSize; i++)
+	{
+		window[i] = (float) (0.5 - 0.5 * cos(2 * M_PI * i / fftSize));
+		open[i].end = 0; // closed
+	}
+
+	// Noise floor
+	for (uint32_t i = 0; i < numFloorFrames && error == 0; i++)
+	{
+		if (fseek(fin, (long) (startOffset + i * floorStride * fftSize * frameBytes), SEEK_SET) ||
+		    getIqSamples(re, im, fftSize, fin, fileFormat) != fftSize)
+		{
+			error = 1;
+			break;
+		}
+		getPowerSpectrum(power, plan, window, re, im);
+		for (uint32_t bin = 0; bin < fftSize; bin++)
+		{
+			floorPowers[(size_t) bin * numFloorFrames + i] = power[bin];
+		}
+	}
+	for (uint32_t bin = 0; bin < fftSize && error == 0; bin++)
+	{
+		float *binPowers = floorPowers + (size_t) bin * numFloorFrames;
+
+		noiseFloor[bin] = 0;
+		if (numFloorFrames != 0)
+		{
+			std::nth_element(binPowers, binPowers + numFloorFrames / 2, binPowers + numFloorFrames);
+			noiseFloor[bin] = binPowers[numFloorFrames / 2] * factor;
+		}
+	}
+
+	// Active bins
+	if (error == 0 && fseek(fin, (long) startOffset, SEEK_SET))
+	{
+		error = 1;
+	}
+	for (uint64_t frame = 0; frame < numFrames && error == 0; frame++)
+	{
+		if (getIqSamples(re, im, fftSize, fin, fileFormat) != fftSize)
+		{
+			error = 1;
+			break;
+		}
+		getPowerSpectrum(power, plan, window, re, im);
+		for (uint32_t bin = 0; bin < fftSize; bin++)
+		{
+			if (power[bin] <= noiseFloor[bin])
+			{
+				continue;
+			}
+			if (open[bin].end != 0 && frame - open[bin].end < hangoverFrames)
+			{
+				open[bin].end    = frame + 1;
+				open[bin].power += power[bin];
+				open[bin].frames++;
+				continue;
+			}
+			if (open[bin].end != 0 && open[bin].frames >= SPECTROGRAM_MIN_FRAMES)
+			{
+				intervals.push_back(open[bin]);
+			}
+			open[bin].binLo   = bin;
+			open[bin].binHi   = bin;
+			open[bin].binPeak = bin;
+			open[bin].start   = frame;
+			open[bin].end     = frame + 1;
+			open[bin].power   = power[bin];
+			open[bin].frames  = 1;
+		}
+	}
+	for (uint32_t bin = 0; bin < fftSize; bin++)
+	{
+		if (open[bin].end != 0 && open[bin].frames >= SPECTROGRAM_MIN_FRAMES)
+		{
+			intervals.push_back(open[bin]);
+		}
+	}
+
+	delete [] window;
+	delete [] re;
+	delete [] im;
+	delete [] power;
+	delete [] floorPowers;
+	delete [] noiseFloor;
+	delete [] open;
+	freeFftPlan(plan);
+	if (error)
+	{
+		fprintf(stderr, "Error: Reading I/Q samples\n");
+		return UINT32_MAX;
+	}
+
+	// Merge intervals of adjacent bins that overlap in time
+	size_t    numIntervals = intervals.size();
+	uint32_t *parent       = new uint32_t[numIntervals + 1];
+	uint32_t *regionIndex  = new uint32_t[numIntervals + 1];
+
+	std::sort(intervals.begin(), intervals.end(), compareRegionBins);
+	for (size_t i = 0; i < numIntervals; i++)
+	{
+		parent[i] = (uint32_t) i;
+	}
+	for (size_t i = 0; i < numIntervals; i++)
+	{
+		for (size_t j = i + 1; j < numIntervals && intervals[j].binLo <= intervals[i].binLo + 1; j++)
+		{
+			if (intervals[j].binLo == intervals[i].binLo + 1 &&
+			    intervals[j].start <  intervals[i].end + hangoverFrames &&
+			    intervals[i].start <  intervals[j].end + hangoverFrames)
+			{
+				uint32_t a = (uint32_t) i;
+				uint32_t b = (uint32_t) j;
+
+				while (parent[a] != a)
+				{
+					a = parent[a];
+				}
+				while (parent[b] != b)
+				{
+					b = parent[b];
+				}
+				parent[std::max(a, b)] = std::min(a, b);
+			}
+		}
+	}
+
+	// Roots come before the rest of their set
+	for (size_t i = 0; i < numIntervals; i++)
+	{
+		const activeRegion &interval = intervals[i];
+		uint32_t root = (uint32_t) i;
+
+		while (parent[root] != root)
+		{
+			root = parent[root];
+		}
+		if (root == i)
+		{
+			regionIndex[i] = (uint32_t) regions.size();
+			regions.push_back(interval);
+			continue;
+		}
+
+		activeRegion &region = regions[regionIndex[root]];
+
+		region.binLo = std::min(region.binLo, interval.binLo);
+		region.binHi = std::max(region.binHi, interval.binHi);
+		region.start = std::min(region.start, interval.start);
+		region.end   = std::max(region.end,   interval.end);
+		if (region.power < interval.power)
+		{
+			region.binPeak = interval.binPeak;
+			region.power   = interval.power;
+			region.frames  = interval.frames;
+		}
+	}
+	delete [] parent;
+	delete [] regionIndex;
+
+	// Frames to samples
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		regions[i].start *= fftSize;
+		regions[i].end   *= fftSize;
+	}
+	std::sort(regions.begin(), regions.end(), compareRegionStarts);
+
+	// Drop splatter (key clicks from a much stronger region at the same time)
+	if (splatterDb > 0)
+	{
+		double   splatterFactor = pow(10.0, splatterDb / 10);
+		size_t   numRegions = regions.size();
+		uint32_t *isSplatter = new uint32_t[numRegions + 1];
+
+		for (size_t i = 0; i < numRegions; i++)
+		{
+			isSplatter[i] = 0;
+		}
+		for (size_t i = 0; i < numRegions; i++)
+		{
+			double power = regions[i].power / regions[i].frames;
+
+			for (size_t j = i + 1; j < numRegions && regions[j].start < regions[i].end; j++)
+			{
+				double otherPower = regions[j].power / regions[j].frames;
+
+				if (power > otherPower * splatterFactor)
+				{
+					isSplatter[j] = 1;
+				}
+				else if (otherPower > power * splatterFactor)
+				{
+					isSplatter[i] = 1;
+				}
+			}
+		}
+		size_t kept = 0;
+		for (size_t i = 0; i < numRegions; i++)
+		{
+			if (!isSplatter[i])
+			{
+				regions[kept++] = regions[i];
+			}
+		}
+		regions.resize(kept);
+		delete [] isSplatter;
+	}
+	return (uint32_t) regions.size();
+}
+
+/**
+ * Mixes a region's peak bin down to 0 Hz and low pass filters it to the region's bandwidth with a
+ * moving average. The envelope is scaled so the loudest sample is 65535.
+ *
+ * @param envelope    - Receives end-start samples
+ * @param start       - First sample
+ * @param end         - One past the last sample
+ * @param region      - The region
+ * @param fftSize     - The FFT size used to find the region
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @return 0 on success, non-zero on error
+ */
+uint32_t getRegionEnvelope(uint32_t *envelope, uint64_t start, uint64_t end, const activeRegion &region, uint32_t fftSize, FILE *fin, uint32_t fileFormat, uint64_t startOffset)
+{
+	uint64_t  frameBytes   = (uint64_t) getSampleByteSize(fileFormat) * (((fileFormat >> 2) & 0xff) + 1);
+	uint32_t  filterLength = fftSize / (region.binHi - region.binLo + 1);
+	double    step         = -2 * M_PI * ((double) region.binPeak - fftSize / 2) / fftSize;
+	double    stepRe       = cos(step);
+	double    stepIm       = sin(step);
+	double    mixRe        = 1;
+	double    mixIm        = 0;
+	double    sumRe        = 0;
+	double    sumIm        = 0;
+	double    maxLevel     = 0;
+	float    *historyRe    = new float[filterLength];
+	float    *historyIm    = new float[filterLength];
+	float    *level        = new float[end - start];
+	float     re[256];
+	float     im[256];
+
+	for (uint32_t i = 0; i < filterLength; i++)
+	{
+		historyRe[i] = 0;
+		historyIm[i] = 0;
+	}
+	if (fseek(fin, (long) (startOffset + start * frameBytes), SEEK_SET))
+	{
+		perror("fseek");
+		delete [] historyRe;
+		delete [] historyIm;
+		delete [] level;
+		return 1;
+	}
+	for (uint64_t i = 0; i < end - start; )
+	{
+		uint32_t count = (uint32_t) std::min((uint64_t) 256, end - start - i);
+
+		if (getIqSamples(re, im, count, fin, fileFormat) != count)
+		{
+			fprintf(stderr, "Error: Reading I/Q samples\n");
+			delete [] historyRe;
+			delete [] historyIm;
+			delete [] level;
+			return 1;
+		}
+		for (uint32_t j = 0; j < count; j++, i++)
+		{
+			uint32_t slot  = (uint32_t) (i % filterLength);
+			double   outRe = re[j] * mixRe - im[j] * mixIm;
+			double   outIm = re[j] * mixIm + im[j] * mixRe;
+			double   tmp   = mixRe * stepRe - mixIm * stepIm;
+
+			mixIm  = mixRe * stepIm + mixIm * stepRe;
+			mixRe  = tmp;
+			sumRe += outRe - historyRe[slot];
+			sumIm += outIm - historyIm[slot];
+			historyRe[slot] = (float) outRe;
+			historyIm[slot] = (float) outIm;
+			level[i] = (float) sqrt(sumRe * sumRe + sumIm * sumIm);
+			if (maxLevel < level[i])
+			{
+				maxLevel = level[i];
+			}
+		}
+
+		// Keep the oscillator on the unit circle
+		double scale = 1 / sqrt(mixRe * mixRe + mixIm * mixIm);
+		mixRe *= scale;
+		mixIm *= scale;
+	}
+	for (uint64_t i = 0; i < end - start; i++)
+	{
+		envelope[i] = 0;
+		if (maxLevel > 0)
+		{
+			envelope[i] = (uint32_t) (level[i] * 65535 / maxLevel);
+		}
+	}
+	delete [] historyRe;
+	delete [] historyIm;
+	delete [] level;
+	return 0;
+}
+
+/**
+ * The active regions being decoded by decodeRegionJobs().
+ */
+struct regionJobs
+{
+	const decodeOptions             *options;
+	const std::vector<activeRegion> *regions;
+	const char                      *fileName;
+	uint32_t                         fileFormat;
+	uint64_t                         startOffset;
+	uint64_t                         numSamples;
+	uint32_t                         sampleRate;
+	std::atomic<uint64_t>            next;  // Next region to decode
+	std::atomic<uint32_t>            error;
+	reorderBuffer                    buffer;
+};
+
+/**
+ * Outputs the data of an active region.
+ *
+ * @param out         - Where to output
+ * @param number      - The region number
+ * @param region      - The region
+ * @param options     - The settings
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of I/Q samples in fin
+ * @param sampleRate  - The sample rate or 0 if unknown
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeRegion(FILE *out, uint32_t number, const activeRegion &region, const decodeOptions &options, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples, uint32_t sampleRate)
+{
+	uint32_t fftSize = options.fftSize;
+	uint64_t start   = 0;
+	uint64_t end     = std::min(region.end + 2 * fftSize, numSamples);
+
+	if (region.start > 2 * fftSize)
+	{
+		start = region.start - 2 * fftSize;
+	}
+	fprintf(out, "\nRegion %u: bins %u-%u, samples %" PRIu64 "-%" PRIu64 "\n", number, region.binLo, region.binHi, region.start, region.end);
+	if (sampleRate != 0)
+	{
+		fprintf(out, "frequency: %+0.3f kHz\n", ((double) region.binPeak - fftSize / 2) * sampleRate / fftSize / 1000);
+	}
+
+	uint32_t *envelope = (uint32_t*) allocLarge((end - start) * sizeof(uint32_t), LARGE_SAMPLES);
+
+	if (getRegionEnvelope(envelope, start, end, region, fftSize, fin, fileFormat, startOffset))
+	{
+		freeLarge(envelope, (end - start) * sizeof(uint32_t));
+		return 1;
+	}
+
+	// Envelope is 16 bit unsigned
+	sampleStream stream = makeMemoryStream(envelope, end - start, makeFileFormat(2, 1, 0, 0, 1));
+
+	decodeSamples(stream, sampleRate, options, out);
+	freeLarge(envelope, (end - start) * sizeof(uint32_t));
+	return 0;
+}
+
+/**
+ * Decodes regions until there are none left. Output is released in region order.
+ *
+ * @param jobs - The regions
+ * @param fin  - The input file (only used by this thread)
+ */
+void decodeRegionJobs(regionJobs &jobs, FILE *fin)
+{
+	while (!jobs.error)
+	{
+		uint64_t i = jobs.next++;
+		char    *output;
+		size_t   size;
+		uint32_t error;
+
+		if (i >= jobs.regions->size())
+		{
+			break;
+		}
+		waitForSlot(jobs.buffer, i);
+
+		FILE *out = open_memstream(&output, &size);
+		if (out == NULL)
+		{
+			perror("open_memstream");
+			output = NULL;
+			size   = 0;
+			error  = 1;
+		}
+		else
+		{
+			error = decodeRegion(out, (uint32_t) i + 1, (*jobs.regions)[i], *jobs.options, fin, jobs.fileFormat, jobs.startOffset, jobs.numSamples, jobs.sampleRate);
+			fclose(out);
+		}
+		if (error)
+		{
+			jobs.error = 1;
+		}
+		releaseOutput(jobs.buffer, i, output, size, error);
+	}
+}
+
+/**
+ * Thread for decodeRegionJobs() with its own handle to the input file.
+ */
+void runRegionThread(regionJobs *jobs)
+{
+	FILE *fin = fopen(jobs->fileName, "rb");
+
+	if (fin == NULL)
+	{
+		perror("fopen");
+		jobs->error = 1;
+		return;
+	}
+	decodeRegionJobs(*jobs, fin);
+	fclose(fin);
+}
+
+/**
+ * Finds active regions of an I/Q file and outputs the data of each region.
+ *
+ * @param options     - The settings
+ * @param fileName    - The input file's name (for opening it on other threads)
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of I/Q samples in fin
+ * @param sampleRate  - The sample rate or 0 if unknown
+ * @param out         - Where to output progress and the data
+ * @return The number of regions or UINT32_MAX on error
+ */
+uint32_t decodeRegions(const decodeOptions &options, const char *fileName, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples, uint32_t sampleRate, FILE *out)
+{
+	std::vector<activeRegion> regions;
+	regionJobs                jobs;
+
+	fprintf(out, "Scanning spectrogram...\n");
+	if (scanSpectrogram(regions, options, fin, fileFormat, startOffset, numSamples) == UINT32_MAX)
+	{
+		return UINT32_MAX;
+	}
+	fprintf(out, "Active regions: %u\n", (uint32_t) regions.size());
+
+	// A job holds its region's envelope and levels while decoding it
+	uint64_t maxLength = 0;
+	uint32_t numJobs;
+
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		maxLength = std::max(maxLength, regions[i].end - regions[i].start + 4 * options.fftSize);
+	}
+	numJobs = planJobs(options, maxLength * (sizeof(uint32_t) + sizeof(float)) + getDecodeBytes(makeFileFormat(2, 1, 0, 0, 1), 0, maxLength, options), "regions", out);
+	if (numJobs == 0)
+	{
+		return UINT32_MAX;
+	}
+	fflush(out);
+
+	jobs.options          = &options;
+	jobs.regions          = &regions;
+	jobs.fileName         = fileName;
+	jobs.fileFormat       = fileFormat;
+	jobs.startOffset      = startOffset;
+	jobs.numSamples       = numSamples;
+	jobs.sampleRate       = sampleRate;
+	jobs.next             = 0;
+	jobs.error            = 0;
+	initReorderBuffer(jobs.buffer, 2 * numJobs, out);
+
+	if (numJobs <= 1)
+	{
+		decodeRegionJobs(jobs, fin);
+	}
+	else
+	{
+		std::vector<std::thread> threads;
+
+		for (uint32_t i = 0; i < numJobs; i++)
+		{
+			threads.push_back(std::thread(runRegionThread, &jobs));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+	}
+	delete [] jobs.buffer.slots;
+	if (jobs.error)
+	{
+		return UINT32_MAX;
+	}
+	return (uint32_t) regions.size();
+}
+
+/**
+ * Reads samples for the mixer. I/Q is channel 0 and 1, otherwise the file format's channel is
+ * a real signal.
+ *
+ * @param re         - Receives the in-phase (or real) values
+ * @param im         - Receives the quadrature values (0 for real)
+ * @param count      - Number of samples to read
+ * @param fin        - The input file at an offset into the data
+ * @param fileFormat - The file format
+ * @param isIq       - If the file is I/Q
+ * @return The number of samples read
+ */
+uint32_t getMixerSamples(float *re, float *im, uint32_t count, FILE *fin, uint32_t fileFormat, uint32_t isIq)
+{
+	uint8_t  raw[65536];
+	uint32_t samples[1024];
+	uint32_t sampleSize = getSampleByteSize(fileFormat);
+	uint32_t frameSize  = sampleSize * (((fileFormat >> 2) & 0xff) + 1);
+	float    center     = (float) (((uint64_t) 1) << (8 * sampleSize - 1));
+	uint32_t iFormat    = fileFormat;
+	uint32_t qFormat    = (fileFormat & ~(0xff << 10)) | (1 << 10);
+	uint32_t done       = 0;
+
+	if (isIq)
+	{
+		iFormat = fileFormat & ~(0xff << 10);
+	}
+	while (done < count)
+	{
+		uint32_t want = std::min(count - done, std::min((uint32_t) 1024, (uint32_t) sizeof(raw) / frameSize));
+		uint32_t got  = (uint32_t) fread(raw, frameSize, want, fin);
+
+		kernels.convertSamples(samples, raw, got, iFormat);
+		for (uint32_t i = 0; i < got; i++)
+		{
+			re[done + i] = (float) samples[i] - center;
+			im[done + i] = 0;
+		}
+		if (isIq)
+		{
+			kernels.convertSamples(samples, raw, got, qFormat);
+			for (uint32_t i = 0; i < got; i++)
+			{
+				im[done + i] = (float) samples[i] - center;
+			}
+		}
+		done += got;
+		if (got < want)
+		{
+			if (ferror(fin))
+			{
+				perror("fread");
+			}
+			break;
+		}
+	}
+	return done;
+}
+
+/**
+ * Estimates the carrier frequency from the average power spectrum of up to
+ * DOWNCONVERT_AUTO_FRAMES frames spread over the file. The bins next to 0 Hz are skipped (DC
+ * offset) and for a real signal only positive frequencies are searched.
+ *
+ * @param frequency   - Receives the carrier frequency in cycles/sample
+ * @param fftSize     - The FFT size
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of samples in fin
+ * @param isIq        - If the file is I/Q
+ * @return 0 on success, non-zero on error
+ */
+uint32_t estimateCarrier(double *frequency, uint32_t fftSize, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples, uint32_t isIq)
+{
+	uint64_t  numFrames  = numSamples / fftSize;
+	uint64_t  stride     = numFrames / DOWNCONVERT_AUTO_FRAMES + 1;
+	uint64_t  frameBytes = (uint64_t) getSampleByteSize(fileFormat) * (((fileFormat >> 2) & 0xff) + 1);
+	fftPlan   plan       = makeFftPlan(fftSize);
+	float    *window     = new float[fftSize];
+	float    *re         = new float[fftSize];
+	float    *im         = new float[fftSize];
+	float    *power      = new float[fftSize];
+	double   *average    = new double[fftSize];
+	uint32_t  peak       = 0;
+	uint32_t  error      = 0;
+
+	for (uint32_t i = 0; i < fftSize; i++)
+	{
+		window[i]  = (float) (0.5 - 0.5 * cos(2 * M_PI * i / fftSize));
+		average[i] = 0;
+	}
+	for (uint64_t frame = 0; frame < numFrames && !error; frame += stride)
+	{
+		if (fseek(fin, (long) (startOffset + frame * fftSize * frameBytes), SEEK_SET))
+		{
+			perror("fseek");
+			error = 1;
+		}
+		else if (getMixerSamples(re, im, fftSize, fin, fileFormat, isIq) != fftSize)
+		{
+			fprintf(stderr, "Error: Reading samples\n");
+			error = 1;
+		}
+		else
+		{
+			getPowerSpectrum(power, plan, window, re, im);
+			for (uint32_t i = 0; i < fftSize; i++)
+			{
+				average[i] += power[i];
+			}
+		}
+	}
+	if (!error)
+	{
+		for (uint32_t i = 1; i < fftSize - 1; i++)
+		{
+			if ((i + 1 < fftSize / 2 && isIq) || i > fftSize / 2 + 1)
+			{
+				if (peak == 0 || average[peak] < average[i])
+				{
+					peak = i;
+				}
+			}
+		}
+		if (numFrames == 0 || average[peak] <= 0)
+		{
+			fprintf(stderr, "Error: Can't find a carrier\n");
+			error = 1;
+		}
+	}
+	if (!error)
+	{
+		// Parabolic interpolation between bins
+		double a     = average[peak - 1];
+		double b     = average[peak];
+		double c     = average[peak + 1];
+		double delta = 0;
+
+		if (a - 2 * b + c != 0)
+		{
+			delta = 0.5 * (a - c) / (a - 2 * b + c);
+		}
+		*frequency = (peak + delta - fftSize / 2) / fftSize;
+	}
+	freeFftPlan(plan);
+	delete [] window;
+	delete [] re;
+	delete [] im;
+	delete [] power;
+	delete [] average;
+	return error;
+}
+
+/**
+ * Mixes a carrier down to 0 Hz then low pass filters and decimates by summing each group of
+ * decimation samples. The magnitude of a group doesn't depend on the oscillator's phase at the
+ * start of the group so the oscillator is one table reused for every block of whole groups. The
+ * magnitudes are scaled to 16 bit unsigned.
+ *
+ * @param envelope    - Receives numSamples/decimation values
+ * @param frequency   - The carrier frequency in cycles/sample
+ * @param decimation  - The decimation factor
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of samples in fin
+ * @param isIq        - If the file is I/Q
+ * @return 0 on success, non-zero on error
+ */
+uint32_t downconvert(uint32_t *envelope, double frequency, uint32_t decimation, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples, uint32_t isIq)
+{
+	uint64_t  numOut    = numSamples / decimation;
+	uint32_t  blockSize = decimation * std::max((uint32_t) 1, DOWNCONVERT_BLOCK / decimation);
+	double    maxLevel  = 0;
+	float    *oscRe     = new float[blockSize];
+	float    *oscIm     = new float[blockSize];
+	float    *re        = new float[blockSize];
+	float    *im        = new float[blockSize];
+	float    *level     = new float[numOut + 1];
+	uint32_t  error     = 0;
+
+	for (uint32_t i = 0; i < blockSize; i++)
+	{
+		oscRe[i] = (float) cos(-2 * M_PI * frequency * i);
+		oscIm[i] = (float) sin(-2 * M_PI * frequency * i);
+	}
+	if (fseek(fin, (long) startOffset, SEEK_SET))
+	{
+		perror("fseek");
+		error = 1;
+	}
+	for (uint64_t out = 0; out < numOut && !error; )
+	{
+		uint32_t groups = (uint32_t) std::min((uint64_t) (blockSize / decimation), numOut - out);
+		uint32_t count  = groups * decimation;
+
+		if (getMixerSamples(re, im, count, fin, fileFormat, isIq) != count)
+		{
+			fprintf(stderr, "Error: Reading samples\n");
+			error = 1;
+			break;
+		}
+		kernels.mixSamples(re, im, oscRe, oscIm, count);
+		for (uint32_t i = 0; i < groups; i++, out++)
+		{
+			double sumRe = 0;
+			double sumIm = 0;
+
+			for (uint32_t j = i * decimation; j < (i + 1) * decimation; j++)
+			{
+				sumRe += re[j];
+				sumIm += im[j];
+			}
+			level[out] = (float) (sqrt(sumRe * sumRe + sumIm * sumIm) / decimation);
+			if (maxLevel < level[out])
+			{
+				maxLevel = level[out];
+			}
+		}
+	}
+	for (uint64_t i = 0; i < numOut && !error; i++)
+	{
+		envelope[i] = 0;
+		if (maxLevel > 0)
+		{
+			envelope[i] = (uint32_t) (level[i] * 65535 / maxLevel);
+		}
+	}
+	delete [] oscRe;
+	delete [] oscIm;
+	delete [] re;
+	delete [] im;
+	delete [] level;
+	return error;
+}
+
+/**
+ * Demodulates FSK. Mixes a carrier down to 0 Hz (unless it's 0) then low pass filters and
+ * decimates like downconvert(). The frequency of each group is the phase step from the group
+ * before. Groups whose average magnitude over FSK_SQUELCH_GROUPS groups is off (by the same
+ * threshold as OOK) are silence (0) and the frequencies of the rest are scaled so the lowest 2%
+ * to the highest 2% are 1 to 65535, the higher tone is on.
+ *
+ * @param envelope    - Receives numSamples/decimation values
+ * @param frequency   - The carrier frequency in cycles/sample
+ * @param decimation  - The decimation factor
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of samples in fin
+ * @param isIq        - If the file is I/Q
+ * @return 0 on success, non-zero on error
+ */
+uint32_t fskDemodulate(uint32_t *envelope, double frequency, uint32_t decimation, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples, uint32_t isIq)
+{
+	uint64_t  numOut         = numSamples / decimation;
+	uint32_t  blockSize      = decimation * std::max((uint32_t) 1, DOWNCONVERT_BLOCK / decimation);
+	uint32_t  envelopeFormat = makeFileFormat(2, 1, 0, 0, 1);
+	double    maxLevel       = 0;
+	float    *oscRe          = new float[blockSize];
+	float    *oscIm          = new float[blockSize];
+	float    *re             = new float[blockSize];
+	float    *im             = new float[blockSize];
+	float    *groupRe        = new float[numOut];
+	float    *groupIm        = new float[numOut];
+	float    *freq           = new float[numOut];
+	uint32_t *counts         = new uint32_t[65536]();
+	uint32_t  numLoud        = 0;
+	uint32_t  squelch;
+	uint32_t  lo;
+	uint32_t  hi;
+	uint32_t  error          = 0;
+
+	for (uint32_t i = 0; i < blockSize; i++)
+	{
+		oscRe[i] = (float) cos(-2 * M_PI * frequency * i);
+		oscIm[i] = (float) sin(-2 * M_PI * frequency * i);
+	}
+	if (fseek(fin, (long) startOffset, SEEK_SET))
+	{
+		perror("fseek");
+		error = 1;
+	}
+	for (uint64_t out = 0; out < numOut && !error; )
+	{
+		uint32_t groups = (uint32_t) std::min((uint64_t) (blockSize / decimation), numOut - out);
+		uint32_t count  = groups * decimation;
+
+		if (getMixerSamples(re, im, count, fin, fileFormat, isIq) != count)
+		{
+			fprintf(stderr, "Error: Reading samples\n");
+			error = 1;
+			break;
+		}
+		// Unlike the magnitudes the phases depend on the oscillator's phase at the start of the
+		// block so the groups are rotated by it
+		double blockPhase = -2 * M_PI * fmod(frequency * (double) (out * decimation), 1.0);
+		double blockRe    = cos(blockPhase);
+		double blockIm    = sin(blockPhase);
+
+		if (frequency != 0)
+		{
+			kernels.mixSamples(re, im, oscRe, oscIm, count);
+		}
+		for (uint32_t i = 0; i < groups; i++, out++)
+		{
+			double sumRe = 0;
+			double sumIm = 0;
+
+			for (uint32_t j = i * decimation; j < (i + 1) * decimation; j++)
+			{
+				sumRe += re[j];
+				sumIm += im[j];
+			}
+			groupRe[out] = (float) ((sumRe * blockRe - sumIm * blockIm) / decimation);
+			groupIm[out] = (float) ((sumRe * blockIm + sumIm * blockRe) / decimation);
+			maxLevel = std::max(maxLevel, sqrt(sumRe * sumRe + sumIm * sumIm) / decimation);
+		}
+	}
+	if (!error)
+	{
+		double   sum  = 0;
+		uint64_t half = FSK_SQUELCH_GROUPS / 2;
+
+		// Average magnitudes in 16 bits for now to threshold them. The noise of single groups
+		// would break up tones that are only a little louder than silence.
+		for (uint64_t i = 0; i < numOut; i++)
+		{
+			freq[i] = sqrtf(groupRe[i] * groupRe[i] + groupIm[i] * groupIm[i]);
+		}
+		for (uint64_t i = 0; i < numOut + half; i++)
+		{
+			if (i < numOut)
+			{
+				sum += freq[i];
+			}
+			if (i >= FSK_SQUELCH_GROUPS)
+			{
+				sum -= freq[i - FSK_SQUELCH_GROUPS];
+			}
+			if (i >= half)
+			{
+				uint64_t count = std::min(i, numOut - 1) - (i < FSK_SQUELCH_GROUPS ? 0 : i - FSK_SQUELCH_GROUPS + 1) + 1;
+
+				envelope[i - half] = 0;
+				if (maxLevel > 0)
+				{
+					envelope[i - half] = std::min((uint32_t) 65535, (uint32_t) (std::max(0.0, sum) / count * 65535 / maxLevel));
+				}
+				counts[envelope[i - half]]++;
+			}
+		}
+		squelch = findOnOffThreshold(counts, (uint32_t) numOut, envelopeFormat, 0, 0.5);
+		memset(counts, 0, 65536 * sizeof(uint32_t));
+
+		// The first group has no group before it so it gets the second one's frequency
+		for (uint64_t i = 1; i < numOut; i += DOWNCONVERT_BLOCK)
+		{
+			kernels.discriminateSamples(freq + i, groupRe + i - 1, groupIm + i - 1, (uint32_t) std::min((uint64_t) DOWNCONVERT_BLOCK, numOut - i));
+		}
+		freq[0] = numOut > 1 ? freq[1] : 0;
+
+		// Silence is 0 and tones are 1 + their frequency in 16 bits for now
+		for (uint64_t i = 0; i < numOut; i++)
+		{
+			if (envelope[i] < squelch)
+			{
+				envelope[i] = 0;
+			}
+			else
+			{
+				uint32_t value = std::min((uint32_t) 65535, (uint32_t) ((freq[i] + 1) * 32767.5f));
+
+				counts[value]++;
+				numLoud++;
+				envelope[i] = value + 1;
+			}
+		}
+		if (findOnOffRange(counts, numLoud, envelopeFormat, 0, &lo, &hi))
+		{
+			// One tone
+			lo = 0;
+			hi = 65535;
+		}
+		for (uint64_t i = 0; i < numOut; i++)
+		{
+			if (envelope[i] != 0)
+			{
+				uint32_t value = std::min(std::max(envelope[i] - 1, lo), hi);
+
+				envelope[i] = 1 + (uint32_t) ((uint64_t) (value - lo) * 65534 / (hi - lo));
+			}
+		}
+	}
+	delete [] oscRe;
+	delete [] oscIm;
+	delete [] re;
+	delete [] im;
+	delete [] groupRe;
+	delete [] groupIm;
+	delete [] freq;
+	delete [] counts;
+	return error;
+}
+
+/**
+ * Mixes the carrier down to 0 Hz, decimates and outputs the data. With --fsk the frequency is
+ * demodulated instead of the amplitude and without --downconvert the I/Q is already at 0 Hz.
+ *
+ * @param options     - The settings
+ * @param fin         - The input file
+ * @param fileFormat  - The file format
+ * @param startOffset - Offset of the data in fin
+ * @param numSamples  - Number of samples in fin
+ * @param sampleRate  - The sample rate or 0 if unknown
+ * @param out         - Where to output progress and the data
+ * @return The bit length of the data or UINT32_MAX on error
+ */
+uint32_t decodeDownconverted(const decodeOptions &options, FILE *fin, uint32_t fileFormat, uint64_t startOffset, uint64_t numSamples, uint32_t sampleRate, FILE *out)
+{
+	uint32_t  decimation = options.decimation;
+	uint64_t  numOut     = numSamples / decimation;
+	uint32_t  bitLength;
+	double    frequency  = 0;
+	uint32_t  error;
+
+	// Without --downconvert it's FSK at 0 Hz
+	if (options.downconvert && options.carrierAuto)
+	{
+		fprintf(out, "Finding carrier...\n");
+		if (estimateCarrier(&frequency, options.fftSize, fin, fileFormat, startOffset, numSamples, options.iq))
+		{
+			return UINT32_MAX;
+		}
+	}
+	else if (options.downconvert)
+	{
+		if (sampleRate == 0)
+		{
+			fprintf(stderr, "Error: --downconvert needs the sample rate (use --sample-rate for raw files)\n");
+			return UINT32_MAX;
+		}
+		frequency = options.carrierHz / sampleRate;
+	}
+	if (options.downconvert && sampleRate != 0)
+	{
+		fprintf(out, "carrier: %+0.3f kHz\n", frequency * sampleRate / 1000);
+	}
+	else if (options.downconvert)
+	{
+		fprintf(out, "carrier: %+0.6f cycles/sample\n", frequency);
+	}
+	if (numOut == 0)
+	{
+		fprintf(stderr, "Error: Fewer samples than the decimation\n");
+		return UINT32_MAX;
+	}
+
+	fprintf(out, options.fsk ? "Demodulating FSK...\n" : "Downconverting...\n");
+	uint32_t *envelope = (uint32_t*) allocLarge(numOut * sizeof(uint32_t), LARGE_SAMPLES);
+
+	if (options.fsk)
+	{
+		error = fskDemodulate(envelope, frequency, decimation, fin, fileFormat, startOffset, numSamples, options.iq);
+	}
+	else
+	{
+		error = downconvert(envelope, frequency, decimation, fin, fileFormat, startOffset, numSamples, options.iq);
+	}
+	if (error)
+	{
+		freeLarge(envelope, numOut * sizeof(uint32_t));
+		return UINT32_MAX;
+	}
+
+	// Envelope is 16 bit unsigned at the decimated sample rate
+	sampleStream stream = makeMemoryStream(envelope, numOut, makeFileFormat(2, 1, 0, 0, 1));
+
+	bitLength = decodeSamples(stream, (uint32_t) ((sampleRate + decimation / 2) / decimation), options, out);
+	freeLarge(envelope, numOut * sizeof(uint32_t));
+	return bitLength;
+}
+
+/**
+ * Outputs activity per time range from an --overview file without reading the samples.
+ *
+ * @param fileName   - The overview file name
+ * @param step       - Seconds per row, or samples if the sample rate isn't known. Rounded to whole entries
+ * @param activityDb - How far above the noise floor is activity
+ * @param out        - Where to output the rows
+ * @return 0 on success, non-zero on error
+ */
+uint32_t queryOverview(const char *fileName, double step, double activityDb, FILE *out)
+{
+	FILE          *fin = fopen(fileName, "rb");
+	overviewHeader header;
+	overviewEntry  entries[4096];
+	uint64_t       offset = sizeof(overviewHeader);
+	uint64_t       stepSamples;
+	uint64_t       entrySize;
+	uint64_t       numEntries;
+	uint32_t       level = 0;
+
+	if (fin == NULL)
+	{
+		perror("fopen");
+		return 1;
+	}
+	if (fread(&header, sizeof(overviewHeader), 1, fin) != 1 ||
+	    header.tag        != OVERVIEW_TAG     ||
+	    header.version    != OVERVIEW_VERSION ||
+	    header.numLevels  == 0                ||
+	    header.levelShift == 0                ||
+	    (uint64_t) header.levelShift * header.numLevels > 48)
+	{
+		fprintf(stderr, "Error: \"%s\" isn't an overview file\n", fileName);
+		fclose(fin);
+		return 1;
+	}
+	stepSamples = (uint64_t) std::max(1.0, header.sampleRate != 0 ? step * header.sampleRate : step);
+
+	// Coarsest level with entries no longer than a row
+	entrySize = ((uint64_t) 1) << header.levelShift;
+	while (level + 1 < header.numLevels && (entrySize << header.levelShift) <= stepSamples)
+	{
+		offset += (header.numSamples + entrySize - 1) / entrySize * sizeof(overviewEntry);
+		entrySize <<= header.levelShift;
+		level++;
+	}
+	numEntries  = (header.numSamples + entrySize - 1) / entrySize;
+	stepSamples = std::max(stepSamples / entrySize, (uint64_t) 1) * entrySize;
+	if (fseek(fin, (long) offset, SEEK_SET))
+	{
+		perror("fseek");
+		fclose(fin);
+		return 1;
+	}
+
+	uint64_t                   numRows = (header.numSamples + stepSamples - 1) / stepSamples;
+	std::vector<overviewEntry> rows(numRows, overviewEntry{UINT32_MAX, 0, 0});
+	std::vector<uint32_t>      peakToPeak(numRows);
+
+	for (uint64_t i = 0; i < numEntries; )
+	{
+		size_t want = (size_t) std::min((uint64_t) (sizeof(entries) / sizeof(overviewEntry)), numEntries - i);
+
+		if (fread(entries, sizeof(overviewEntry), want, fin) != want)
+		{
+			fprintf(stderr, "Error: \"%s\" is truncated\n", fileName);
+			fclose(fin);
+			return 1;
+		}
+		for (size_t j = 0; j < want; j++, i++)
+		{
+			overviewEntry &row = rows[i * entrySize / stepSamples];
+
+			row.min     = std::min(row.min, entries[j].min);
+			row.max     = std::max(row.max, entries[j].max);
+			row.energy += entries[j].energy * (double) std::min(entrySize, header.numSamples - i * entrySize);
+		}
+	}
+	fclose(fin);
+
+	// The median row is the noise floor
+	for (uint64_t i = 0; i < numRows; i++)
+	{
+		peakToPeak[i] = rows[i].max >= rows[i].min ? rows[i].max - rows[i].min : 0;
+	}
+	uint32_t floor = 1;
+	if (numRows != 0)
+	{
+		std::nth_element(peakToPeak.begin(), peakToPeak.begin() + numRows / 2, peakToPeak.end());
+		floor = std::max(peakToPeak[numRows / 2], (uint32_t) 1);
+	}
+
+	double scale = header.sampleRate != 0 ? 1.0 / header.sampleRate : 1.0;
+
+	fprintf(out, "%" PRIu64 " samples, %" PRIu64 " samples/entry, noise floor %u\n", header.numSamples, entrySize, floor);
+	fprintf(out, "%14s %14s %10s %10s %12s %8s\n", header.sampleRate != 0 ? "start (s)" : "start", header.sampleRate != 0 ? "end (s)" : "end", "min", "max", "rms", "dB");
+	for (uint64_t i = 0; i < numRows; i++)
+	{
+		uint64_t start = i * stepSamples;
+		uint64_t end   = std::min(start + stepSamples, header.numSamples);
+		double   db    = 20.0 * log10((double) std::max(rows[i].max - std::min(rows[i].min, rows[i].max), (uint32_t) 1) / floor);
+
+		fprintf(out, "%14.3f %14.3f %10u %10u %12.1f %8.1f%s\n",
+			start * scale, end * scale, rows[i].min, rows[i].max, sqrt(rows[i].energy / (end - start)), db,
+			db >= activityDb ? " active" : "");
+	}
+	return 0;
+}
+
+/**
+ * Reads the header of a .wav file or checks the size of a raw file.
+ *
+ * @param fin         - The input file at the start
+ * @param options     - The settings
+ * @param out         - Where to output progress or NULL
+ * @param fileFormat  - Receives the file format
+ * @param startOffset - Receives the offset of the data in fin (fin is left there)
+ * @param sampleRate  - Receives the sample rate or 0 if unknown
+ * @param numSamples  - Receives the number of samples
+ * @return 0 on success, non-zero on error
+ */
+uint32_t readFileHeader(FILE *fin, const decodeOptions &options, FILE *out, uint32_t *fileFormat, uint64_t *startOffset, uint32_t *sampleRate, uint64_t *numSamples)
+{
+	wavHeader  header;
+	uint64_t   fileSize;
+
+	*startOffset = 0;
+	*sampleRate  = 0;
+	// 16 bits/sample, 1 channel, signed integers, little endian
+	*fileFormat  = makeFileFormat(2, 1, 0, 1, 1);
+	if (options.iq)
+	{
+		// 16 bits/sample, 2 channels (I/Q), signed integers, little endian
+		*fileFormat = makeFileFormat(2, 2, 0, 1, 1);
+	}
+
+	// File size
+    fseek(fin, 0, SEEK_END);
+    fileSize = (uint64_t) ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+
+	// Read wav header
+	if (fileSize >= 44)
+	{
+		if (fread(&header, sizeof(wavHeader), 1, fin) != 1)
+		{
+			perror("fread");
+			return 1;
+		}
+
+		// Sizes of .wav files over 4 GiB wrap or are 0xffffffff
+		if (header.tag           == 0x46464952   && // "RIFF"
+		    (header.fileSize     == (uint32_t) (fileSize - 8) || header.fileSize == UINT32_MAX) &&
+		    header.type          == 0x45564157   && // "WAVE"
+		    header.chunkMarker   == 0x20746d66   && // "fmt "
+		    header.fileSizeSoFar ==         16   &&
+		    header.format        ==          1   && // PCM
+		    header.dataTag       == 0x61746164   && // "data"
+		    (header.dataSize     == (uint32_t) (fileSize - 44) || header.dataSize == UINT32_MAX))
+		{
+			if (header.channels          ==   0 ||
+			    header.channels          >  256 ||
+			    header.bitsPerSample % 8 !=   0 ||
+				header.bitsPerSample     ==   0 ||
+				header.bitsPerSample     >   32)
+			{
+				fprintf(stderr, "Error: Only supports raw 16 bit signed data and 8, 16, 24, 32 bit .wav with <257 channels\n");
+				return 1;
+			}
+			else
+			{
+				if (out != NULL)
+				{
+					fprintf(out, "File is a .wav\n");
+				}
+				*startOffset = 44;
+				*sampleRate  = header.sampleRate;
+				*fileFormat  = makeFileFormat(header.bitsPerSample / 8, header.channels, 0, 1, 1);
+			}
+		}
+		else
+		{
+			if (out != NULL)
+			{
+				fprintf(out, "Assuming file is raw 16 bit signed data\n");
+			}
+			fseek(fin, 0, SEEK_SET);
+		}
+	}
+	if (*startOffset == 0)
+	{
+		if (fileSize % (2 * (((*fileFormat >> 2) & 0xff) + 1)) != 0)
+		{
+			fprintf(stderr, "Error: Only supports raw 16 bit signed data and 8, 16, 24, 32 bit .wav with <257 channels\n");
+			return 1;
+		}
+	}
+
+	if (*sampleRate == 0)
+	{
+		*sampleRate = options.sampleRate;
+	}
+	*numSamples = (fileSize - *startOffset) / (getSampleByteSize(*fileFormat) * (((*fileFormat >> 2) & 0xff) + 1));
+	return 0;
+
+}
+
+/**
+ * Sets up --overview and --rectify for a sample stream of the input then outputs its data.
+ *
+ * @param stream     - The sample stream at the start of the data
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param options    - The settings
+ * @param out        - Where to output progress and the data
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeInput(sampleStream &stream, uint32_t sampleRate, const decodeOptions &options, FILE *out)
+{
+	overviewWriter *overview = NULL;
+	uint32_t        bitLength;
+
+	stream.countShift = options.countShift;
+	if (options.overview != NULL)
+	{
+		overview = makeOverviewWriter(options.overview, stream.fileFormat, sampleRate, options.rectify != 0);
+		if (overview == NULL)
+		{
+			return 1;
+		}
+		stream.overview = overview;
+	}
+	if (options.rectify)
+	{
+		stream.rectify = makeRectifier(options.rectify, stream.fileFormat);
+	}
+	bitLength = decodeSamples(stream, sampleRate, options, out);
+	if (overview != NULL)
+	{
+		// Nothing counted all of the samples (--preamble with --bit-width or --prefix) so it needs its own pass
+		if (stream.overview != NULL)
+		{
+			stream.overview = NULL;
+			rewindStream(stream);
+			runPipeline(stream, STAGE_READ, 0, 0, overviewBlock, overview, options.pipelined);
+		}
+		if (freeOverviewWriter(overview, stream.fileFormat, sampleRate))
+		{
+			bitLength = UINT32_MAX;
+		}
+	}
+	if (stream.rectify != NULL)
+	{
+		freeRectifier(stream.rectify);
+	}
+	if (bitLength == UINT32_MAX)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Gets the samples between --start and --end.
+ *
+ * @param options    - The settings
+ * @param sampleRate - The sample rate or 0 if unknown
+ * @param numSamples - Number of samples in the file
+ * @param first      - Receives the first sample
+ * @param last       - Receives one past the last sample
+ * @return 0 on success, non-zero on error
+ */
+uint32_t getWindow(const decodeOptions &options, uint32_t sampleRate, uint64_t numSamples, uint64_t *first, uint64_t *last)
+{
+	*first = 0;
+	*last  = numSamples;
+	if (options.start != NULL && parseTime(options.start, sampleRate, first))
+	{
+		return 1;
+	}
+	if (options.end != NULL && parseTime(options.end, sampleRate, last))
+	{
+		return 1;
+	}
+	*last = std::min(*last, numSamples);
+	if (*first >= *last)
+	{
+		fprintf(stderr, "Error: No samples between --start and --end (the file has %" PRIu64 ")\n", numSamples);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Plans the decode of a file to fit in options.memoryLimit and outputs the plan. Counting fewer
+ * bits of each sample saves the most, down to 16 bits, then running the stages one block at a
+ * time. Jobs are planned once the bursts or regions are known (see planJobs()).
+ *
+ * @param options    - The settings (receives the plan)
+ * @param fileFormat - The file format
+ * @param numSamples - Number of samples in the file
+ * @param out        - Where to output the plan
+ * @return 0 on success, non-zero if the decode doesn't fit
+ */
+uint32_t planMemory(decodeOptions &options, uint32_t fileFormat, uint64_t numSamples, FILE *out)
+{
+	uint32_t sampleBits     = 8 * getSampleByteSize(fileFormat);
+	uint32_t envelopeFormat = makeFileFormat(2, 1, 0, 0, 1);
+	uint32_t countBits      = 16;
+	uint64_t bytes;
+
+	options.countShift = 0;
+	while (1)
+	{
+		if (options.spectrogram)
+		{
+			// Noise floor frames, FFT buffers and open regions
+			bytes = (uint64_t) options.fftSize * ((SPECTROGRAM_FLOOR_FRAMES + 6) * sizeof(float) + sizeof(activeRegion));
+		}
+		else if (options.fsk)
+		{
+			uint64_t numOut = numSamples / options.decimation;
+
+			// Envelope, groups and frequencies of the whole file
+			bytes = numOut * (sizeof(uint32_t) + 3 * sizeof(float)) + 4 * DOWNCONVERT_BLOCK * sizeof(float) +
+				65536 * sizeof(uint32_t) + getDecodeBytes(envelopeFormat, 0, numOut, options);
+		}
+		else if (options.downconvert)
+		{
+			uint64_t numOut = numSamples / options.decimation;
+
+			// Envelope and levels of the whole file
+			bytes = numOut * (sizeof(uint32_t) + sizeof(float)) + 4 * DOWNCONVERT_BLOCK * sizeof(float) +
+				getDecodeBytes(envelopeFormat, 0, numOut, options);
+		}
+		else if (options.bursts)
+		{
+			// Finding bursts counts and thresholds the file
+			countBits = sampleBits - options.countShift;
+			bytes = getCountsBytes(fileFormat, options.countShift) + getBlocksBytes(options.pipelined);
+		}
+		else
+		{
+			countBits = sampleBits - options.countShift;
+			bytes = getDecodeBytes(fileFormat, options.countShift, numSamples, options);
+		}
+		if (bytes <= options.memoryLimit)
+		{
+			break;
+		}
+		if (countBits > 16 && !options.spectrogram && !options.downconvert && !options.fsk)
+		{
+			options.countShift += 8;
+		}
+		else if (options.pipelined)
+		{
+			options.pipelined = 0;
+		}
+		else
+		{
+			fprintf(stderr, "Error: Decoding needs about %0.1f MiB, more than --memory-limit\n", bytes / 1048576.0);
+			return 1;
+		}
+	}
+	fprintf(out, "Memory plan: %u bit counts, %s, about %0.1f MiB of %0.1f MiB\n",
+		countBits, options.pipelined ? "pipelined" : "a block at a time", bytes / 1048576.0, options.memoryLimit / 1048576.0);
+	return 0;
+}
+
+/**
+ * Outputs the data of an open file.
+ *
+ * @param fin      - The input file
+ * @param fileName - The input file's name (for opening it on other threads)
+ * @param options  - The settings
+ * @param out      - Where to output progress and the data
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeOpenFile(FILE *fin, const char *fileName, const decodeOptions &options, FILE *out)
+{
+	uint32_t fileFormat;
+	uint64_t startOffset;
+	uint32_t sampleRate;
+	uint64_t numSamples;
+
+	if (readFileHeader(fin, options, out, &fileFormat, &startOffset, &sampleRate, &numSamples))
+	{
+		return 1;
+	}
+
+	// Seek straight to --start and stop at --end
+	uint64_t fileSamples = numSamples;
+	uint64_t first;
+	uint64_t last;
+
+	if (getWindow(options, sampleRate, numSamples, &first, &last))
+	{
+		return 1;
+	}
+	if (first != 0 || last != numSamples)
+	{
+		fprintf(out, "Window: samples %" PRIu64 "-%" PRIu64 " of %" PRIu64 "\n", first, last, numSamples);
+		startOffset += first * getSampleByteSize(fileFormat) * (((fileFormat >> 2) & 0xff) + 1);
+		numSamples   = last - first;
+		if (fseek(fin, (long) startOffset, SEEK_SET))
+		{
+			perror("fseek");
+			return 1;
+		}
+	}
+
+	decodeOptions planned = options;
+
+	planned.windowStart = first;
+	if (options.memoryLimit != 0 && planMemory(planned, fileFormat, numSamples, out))
+	{
+		return 1;
+	}
+	if (options.spectrogram)
+	{
+		if (((fileFormat >> 2) & 0xff) + 1 < 2)
+		{
+			fprintf(stderr, "Error: --spectrogram needs I/Q data (2 channels)\n");
+			return 1;
+		}
+		if (decodeRegions(planned, fileName, fin, fileFormat, startOffset, numSamples, sampleRate, out) == UINT32_MAX)
+		{
+			return 1;
+		}
+	}
+	else if (options.downconvert || options.fsk)
+	{
+		if (options.fsk && !options.downconvert && ((fileFormat >> 2) & 0xff) + 1 < 2)
+		{
+			fprintf(stderr, "Error: --fsk needs I/Q data (2 channels) unless it's with --downconvert\n");
+			return 1;
+		}
+		if (options.iq && ((fileFormat >> 2) & 0xff) + 1 < 2)
+		{
+			fprintf(stderr, "Error: --iq needs 2 channels\n");
+			return 1;
+		}
+		if (decodeDownconverted(planned, fin, fileFormat, startOffset, numSamples, sampleRate, out) == UINT32_MAX)
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		sampleStream stream = makeFileStream(fin, fileFormat, startOffset);
+
+		if (numSamples != fileSamples)
+		{
+			stream.limit = numSamples;
+		}
+		return decodeInput(stream, sampleRate, planned, out);
+	}
+	return 0;
+}
+
+/**
+ * Outputs the data of an --archive file. Its bursts are decoded from the frames kept of them so
+ * the output is the same as decoding the original file with --bursts.
+ *
+ * @param fin      - The archive file
+ * @param fileName - The archive file's name
+ * @param options  - The settings
+ * @param out      - Where to output progress and the data
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeArchive(FILE *fin, const char *fileName, const decodeOptions &options, FILE *out)
+{
+	burstIndexHeader        header;
+	std::vector<burst>      bursts;
+	std::vector<archiveGap> gaps;
+	uint64_t                fileSize;
+
+	if (options.spectrogram || options.downconvert || options.fsk || options.start != NULL || options.end != NULL ||
+	    options.overview != NULL || options.writeIndex != NULL || options.readIndex != NULL ||
+	    options.extract != NULL || options.archive != NULL || options.maxMessages != 0)
+	{
+		fprintf(stderr, "Error: \"%s\" is an --archive file, it's only decoded as its bursts\n", fileName);
+		return 1;
+	}
+	fseek(fin, 0, SEEK_END);
+	fileSize = (uint64_t) ftell(fin);
+	if (fseek(fin, 0, SEEK_SET) ||
+	    fread(&header, sizeof(burstIndexHeader), 1, fin) != 1 ||
+	    header.tag     != ARCHIVE_TAG ||
+	    header.version != ARCHIVE_VERSION)
+	{
+		fprintf(stderr, "Error: \"%s\" isn't an archive file\n", fileName);
+		return 1;
+	}
+	if (header.numBursts > fileSize / sizeof(burst))
+	{
+		fprintf(stderr, "Error: \"%s\" is truncated\n", fileName);
+		return 1;
+	}
+	bursts.resize(header.numBursts);
+	gaps.resize(header.numBursts + 1);
+	if ((header.numBursts != 0 && fread(bursts.data(), sizeof(burst), bursts.size(), fin) != bursts.size()) ||
+	    fread(gaps.data(), sizeof(archiveGap), gaps.size(), fin) != gaps.size())
+	{
+		fprintf(stderr, "Error: \"%s\" is truncated\n", fileName);
+		return 1;
+	}
+
+	// Each burst's frames are a file of the stream
+	uint32_t                frameSize = getSampleByteSize(header.fileFormat) * (((header.fileFormat >> 2) & 0xff) + 1);
+	uint64_t                offset    = sizeof(burstIndexHeader) + bursts.size() * sizeof(burst) + gaps.size() * sizeof(archiveGap);
+	std::vector<streamFile> files(bursts.size());
+	std::vector<uint64_t>   readAt(bursts.size());
+	uint64_t                kept      = 0;
+
+	for (size_t i = 0; i < bursts.size(); i++)
+	{
+		files[i].fin         = fin;
+		files[i].startOffset = offset;
+		files[i].numSamples  = bursts[i].end - bursts[i].start;
+		readAt[i]            = kept;
+		kept                += files[i].numSamples;
+		offset              += files[i].numSamples * frameSize;
+	}
+	if (offset > fileSize)
+	{
+		fprintf(stderr, "Error: \"%s\" is truncated\n", fileName);
+		return 1;
+	}
+
+	// The levels between the bursts
+	archiveGap idle = {0, UINT32_MAX, 0, 0};
+
+	for (size_t i = 0; i < gaps.size(); i++)
+	{
+		if (gaps[i].length != 0)
+		{
+			idle.length += gaps[i].length;
+			idle.min     = std::min(idle.min, gaps[i].min);
+			idle.max     = std::max(idle.max, gaps[i].max);
+			idle.sum    += gaps[i].sum;
+		}
+	}
+	fprintf(out, "File is an archive of %" PRIu64 " samples, the bursts keep %" PRIu64 " (%0.2f%%)\n",
+		header.numSamples, kept, 100.0 * kept / std::max(header.numSamples, (uint64_t) 1));
+	if (idle.length != 0)
+	{
+		fprintf(out, "Between bursts: %" PRIu64 " samples from %u to %u, mean %u\n", idle.length, idle.min, idle.max, (uint32_t) (idle.sum / idle.length));
+	}
+	fprintf(out, "Bursts: %u\n", (uint32_t) bursts.size());
+	if (bursts.empty())
+	{
+		return 0;
+	}
+
+	sampleStream stream = makeFilesStream(files.data(), (uint32_t) files.size(), header.fileFormat);
+	uint32_t     bitLength;
+
+	if (options.rectify)
+	{
+		stream.rectify = makeRectifier(options.rectify, stream.fileFormat);
+	}
+	bitLength = decodeBurstList(bursts, readAt.data(), stream, header.sampleRate, options, out);
+	if (stream.rectify != NULL)
+	{
+		freeRectifier(stream.rectify);
+	}
+	if (bitLength == UINT32_MAX)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Outputs the data of a file.
+ *
+ * @param fileName - The input file's name
+ * @param options  - The settings
+ * @param out      - Where to output progress and the data
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeFile(const char *fileName, const decodeOptions &options, FILE *out)
+{
+	FILE     *fin = fopen(fileName, "rb");
+	uint32_t  tag = 0;
+	uint32_t  error;
+
+	if (fin == NULL)
+	{
+		perror("fopen");
+		return 1;
+	}
+	if (options.importPulses)
+	{
+		error = decodePulses(fin, options.sampleRate, out) == UINT32_MAX;
+	}
+	else if (fread(&tag, sizeof(tag), 1, fin) == 1 && tag == ARCHIVE_TAG)
+	{
+		error = decodeArchive(fin, fileName, options, out);
+	}
+	else if (fseek(fin, 0, SEEK_SET))
+	{
+		perror("fseek");
+		error = 1;
+	}
+	else
+	{
+		error = decodeOpenFile(fin, fileName, options, out);
+	}
+	fclose(fin);
+	return error;
+}
+
+/**
+ * Outputs the data of files recorded one after another as one stream. Transmissions that cross
+ * from one file to the next are decoded whole and the threshold and bit width are found once.
+ *
+ * @param fileNames - The input files' names in order
+ * @param numFiles  - Number of files
+ * @param options   - The settings
+ * @param out       - Where to output progress and the data
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeFiles(const char *const *fileNames, uint32_t numFiles, const decodeOptions &options, FILE *out)
+{
+	std::vector<streamFile> files;
+	uint32_t                fileFormat = 0;
+	uint32_t                sampleRate = 0;
+	uint32_t                error      = 0;
+
+	for (uint32_t i = 0; i < numFiles && !error; i++)
+	{
+		streamFile file = {fopen(fileNames[i], "rb"), 0, 0};
+		uint32_t   curFormat;
+		uint32_t   curRate;
+
+		if (file.fin == NULL)
+		{
+			perror("fopen");
+			error = 1;
+			break;
+		}
+		if (readFileHeader(file.fin, options, i == 0 ? out : NULL, &curFormat, &file.startOffset, &curRate, &file.numSamples))
+		{
+			error = 1;
+		}
+		else if (i == 0)
+		{
+			fileFormat = curFormat;
+			sampleRate = curRate;
+		}
+		else if (curFormat != fileFormat || curRate != sampleRate)
+		{
+			fprintf(stderr, "Error: \"%s\" isn't the same format as \"%s\"\n", fileNames[i], fileNames[0]);
+			error = 1;
+		}
+		files.push_back(file);
+	}
+	if (!error)
+	{
+		sampleStream  stream     = makeFilesStream(files.data(), (uint32_t) files.size(), fileFormat);
+		decodeOptions planned    = options;
+		uint64_t      numSamples = 0;
+
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			numSamples += files[i].numSamples;
+		}
+		error = options.memoryLimit != 0 && planMemory(planned, fileFormat, numSamples, out);
+		if (!error)
+		{
+			error = decodeInput(stream, sampleRate, planned, out);
+		}
+	}
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		fclose(files[i].fin);
+	}
+	return error;
+}
+
+/**
+ * Output that goes to two files. See decodeCached().
+ */
+struct teeOutput
+{
+	FILE    *first;
+	FILE    *second;
+	uint32_t error;  // Writing to second failed
+};
+
+/**
+ * Writes to both files of a tee. See fopencookie().
+ */
+ssize_t writeTee(void *cookie, const char *data, size_t size)
+{
+	teeOutput *tee = (teeOutput*) cookie;
+
+	if (!tee->error && fwrite(data, 1, size, tee->second) != size)
+	{
+		tee->error = 1;
+	}
+	if (fwrite(data, 1, size, tee->first) != size)
+	{
+		return -1;
+	}
+	return (ssize_t) size;
+}
+
+/**
+ * Flushes the first file of a tee. The files are closed by their owners. See fopencookie().
+ */
+int closeTee(void *cookie)
+{
+	teeOutput *tee = (teeOutput*) cookie;
+
+	return fflush(tee->first);
+}
+
+/**
+ * Makes the key of a --cache entry from the file's identity, size and modification time and
+ * the options that change the output.
+ *
+ * @param key      - Receives the key (from malloc)
+ * @param keySize  - Receives the size of the key
+ * @param fileName - The input file's name
+ * @param argc     - Number of arguments
+ * @param argv     - The arguments
+ * @return 0 on success, non-zero on error
+ */
+uint32_t getCacheKey(char **key, size_t *keySize, const char *fileName, int argc, char *argv[])
+{
+	struct stat info;
+	FILE       *fkey;
+
+	if (stat(fileName, &info))
+	{
+		return 1;
+	}
+	fkey = open_memstream(key, keySize);
+	if (fkey == NULL)
+	{
+		perror("open_memstream");
+		return 1;
+	}
+	fprintf(fkey, "demodulate-ook cache %u\n%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRId64 ".%09ld\n", CACHE_VERSION,
+		(uint64_t) info.st_dev, (uint64_t) info.st_ino, (uint64_t) info.st_size, (int64_t) info.st_mtim.tv_sec, (long) info.st_mtim.tv_nsec);
+	for (int i = 1; i < argc; i++)
+	{
+		// Options that don't change the output
+		if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--pipeline") == 0 || argv[i] == fileName)
+		{
+			continue;
+		}
+		if ((strcmp(argv[i], "--cache") == 0 || strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "--kernels") == 0) && i + 1 < argc)
+		{
+			i++;
+			continue;
+		}
+		fprintf(fkey, "%s\n", argv[i]);
+	}
+	fputc('\n', fkey);
+	fclose(fkey);
+	return 0;
+}
+
+/**
+ * Outputs the data of a file from --cache or decodes it and adds it. Entries are named by a
+ * hash of getCacheKey() and start with the key so a hash collision is a miss.
+ *
+ * @param fileName - The input file's name
+ * @param options  - The settings
+ * @param argc     - Number of arguments
+ * @param argv     - The arguments
+ * @param out      - Where to output progress and the data
+ * @return 0 on success, non-zero on error
+ */
+uint32_t decodeCached(const char *fileName, const decodeOptions &options, int argc, char *argv[], FILE *out)
+{
+	char     *key;
+	size_t    keySize;
+	char      path[4096];
+	char      tempPath[4096 + 8];
+	uint64_t  hash = 0xcbf29ce484222325; // FNV-1a
+	FILE     *fcache;
+	uint32_t  error;
+
+	if (getCacheKey(&key, &keySize, fileName, argc, argv))
+	{
+		return decodeFile(fileName, options, out);
+	}
+	for (size_t i = 0; i < keySize; i++)
+	{
+		hash = (hash ^ (uint8_t) key[i]) * 0x100000001b3;
+	}
+	snprintf(path, sizeof(path), "%s/%016" PRIx64, options.cacheDir, hash);
+
+	// Hit
+	fcache = fopen(path, "rb");
+	if (fcache != NULL)
+	{
+		char   buffer[65536];
+		size_t size = fread(buffer, 1, sizeof(buffer), fcache);
+
+		if (size >= keySize && memcmp(buffer, key, keySize) == 0)
+		{
+			fwrite(buffer + keySize, 1, size - keySize, out);
+			while ((size = fread(buffer, 1, sizeof(buffer), fcache)) != 0)
+			{
+				fwrite(buffer, 1, size, out);
+			}
+			fclose(fcache);
+			free(key);
+			stats.cacheHits++;
+			return 0;
+		}
+		fclose(fcache);
+	}
+
+	// Miss
+	stats.cacheMisses++;
+	snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+
+	int fd = mkstemp(tempPath);
+	if (fd < 0 || (fcache = fdopen(fd, "wb")) == NULL)
+	{
+		perror("Error: Can't add to the cache");
+		if (fd >= 0)
+		{
+			close(fd);
+			remove(tempPath);
+		}
+		free(key);
+		return decodeFile(fileName, options, out);
+	}
+
+	cookie_io_functions_t teeFunctions = {NULL, writeTee, NULL, closeTee};
+	teeOutput             tee          = {out, fcache, 0};
+	FILE                 *teeOut;
+
+	if (fwrite(key, 1, keySize, fcache) != keySize)
+	{
+		tee.error = 1;
+	}
+	free(key);
+	teeOut = fopencookie(&tee, "w", teeFunctions);
+	if (teeOut == NULL)
+	{
+		perror("fopencookie");
+		fclose(fcache);
+		remove(tempPath);
+		return decodeFile(fileName, options, out);
+	}
+	error = decodeFile(fileName, options, teeOut);
+	fclose(teeOut);
+	if (fclose(fcache))
+	{
+		tee.error = 1;
+	}
+
+	// Only complete output of a file that decoded
+	if (!error && !tee.error)
+	{
+		if (rename(tempPath, path))
+		{
+			perror("rename");
+			remove(tempPath);
+		}
+	}
+	else
+	{
+		remove(tempPath);
+	}
+	return error;
+}
+
+/**
+ * Files in a --watch directory waiting for a worker and the record of decoded files.
+ */
+struct watchJobs
+{
+	const decodeOptions    *options;
+	const char             *dirName;
+	FILE                   *processed; // Record of decoded files, a key per line
+	std::set<std::string>   done;      // Keys of decoded or claimed files
+	std::deque<std::string> queue;     // Names of closed files
+	std::mutex              mutex;     // Guards done, queue and stop
+	std::condition_variable added;
+	std::mutex              output;    // Whole files are output at a time
+	uint32_t                stop;
+};
+
+/**
+ * Gets what identifies a decoded file in the --watch record. A file that is written again is
+ * decoded again.
+ *
+ * @param key  - Receives the key
+ * @param path - The file's path
+ * @param name - The file's name in the directory
+ * @return 0 on success, non-zero if it isn't a regular file
+ */
+uint32_t getWatchKey(std::string &key, const char *path, const char *name)
+{
+	struct stat info;
+	char        prefix[64];
+
+	if (stat(path, &info) || !S_ISREG(info.st_mode))
+	{
+		return 1;
+	}
+	snprintf(prefix, sizeof(prefix), "%" PRIu64 " %" PRId64 ".%09ld ",
+		(uint64_t) info.st_size, (int64_t) info.st_mtim.tv_sec, (long) info.st_mtim.tv_nsec);
+	key = prefix;
+	key += name;
+	return 0;
+}
+
+/**
+ * Adds a file of the watched directory to the queue.
+ *
+ * @param jobs - The watch
+ * @param name - The file's name
+ */
+void queueWatched(watchJobs &jobs, const char *name)
+{
+	// Hidden files are the record and files being written by tools that rename when done
+	if (name[0] == '.' || strchr(name, '\n') != NULL)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(jobs.mutex);
+
+	jobs.queue.push_back(name);
+	jobs.added.notify_one();
+}
+
+/**
+ * Queues the files already in the watched directory in name order. Decoded files are skipped
+ * by the workers.
+ *
+ * @param jobs - The watch
+ * @return 0 on success, non-zero on error
+ */
+uint32_t queueDirectory(watchJobs &jobs)
+{
+	std::vector<std::string> names;
+	DIR                     *dir = opendir(jobs.dirName);
+	struct dirent           *entry;
+
+	if (dir == NULL)
+	{
+		perror("opendir");
+		return 1;
+	}
+	while ((entry = readdir(dir)) != NULL)
+	{
+		names.push_back(entry->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		queueWatched(jobs, names[i].c_str());
+	}
+	return 0;
+}
+
+/**
+ * Decodes a file of the watched directory unless it was already, then outputs it whole and
+ * adds it to the record.
+ *
+ * @param jobs    - The watch
+ * @param name    - The file's name
+ * @param options - The settings for one file
+ */
+void decodeWatched(watchJobs &jobs, const std::string &name, const decodeOptions &options)
+{
+	std::string key;
+	std::string path = std::string(jobs.dirName) + "/" + name;
+	char       *output;
+	size_t      size;
+	FILE       *out;
+	uint32_t    error;
+
+	if (getWatchKey(key, path.c_str(), name.c_str()))
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+
+		if (!jobs.done.insert(key).second)
+		{
+			return;
+		}
+	}
+	out = open_memstream(&output, &size);
+	if (out == NULL)
+	{
+		perror("open_memstream");
+		return;
+	}
+	fprintf(out, "\nFile: %s\n", name.c_str());
+	error = decodeFile(path.c_str(), options, out);
+	fclose(out);
+
+	std::lock_guard<std::mutex> lock(jobs.output);
+
+	fwrite(output, 1, size, stdout);
+	fflush(stdout);
+	free(output);
+
+	// Failed files are tried again after a restart
+	if (!error)
+	{
+		fprintf(jobs.processed, "%s\n", key.c_str());
+		fflush(jobs.processed);
+	}
+}
+
+/**
+ * Decodes queued files until the watch stops.
+ *
+ * @param jobs - The watch
+ */
+void runWatchThread(watchJobs *jobs)
+{
+	decodeOptions options = *jobs->options;
+
+	// The workers are the jobs and share the memory
+	options.memoryLimit /= options.jobs;
+	options.jobs = 1;
+	while (1)
+	{
+		std::string name;
+		{
+			std::unique_lock<std::mutex> lock(jobs->mutex);
+
+			while (jobs->queue.empty() && !jobs->stop)
+			{
+				jobs->added.wait(lock);
+			}
+			if (jobs->queue.empty())
+			{
+				break;
+			}
+			name = jobs->queue.front();
+			jobs->queue.pop_front();
+		}
+		decodeWatched(*jobs, name, options);
+	}
+}
+
+/**
+ * Decodes the files in a directory and then each file written or moved into it as soon as it
+ * is closed, with options.jobs workers. Decoded files are recorded in processedName so a
+ * restart only decodes new files. Runs until the directory can't be watched.
+ *
+ * @param dirName       - The directory
+ * @param processedName - The record of decoded files or NULL for .demodulate-ook-processed in
+ *                        the directory
+ * @param options       - The settings
+ * @return 0 on success, non-zero on error
+ */
+uint32_t watchDirectory(const char *dirName, const char *processedName, const decodeOptions &options)
+{
+	watchJobs                jobs;
+	std::vector<std::thread> threads;
+	std::string              recordName;
+	char                     line[8192];
+	alignas(inotify_event) char events[65536];
+	int                      fd;
+	uint32_t                 error = 0;
+
+	recordName = processedName != NULL ? processedName : std::string(dirName) + "/.demodulate-ook-processed";
+	jobs.options = &options;
+	jobs.dirName = dirName;
+	jobs.stop    = 0;
+
+	// Load the record
+	jobs.processed = fopen(recordName.c_str(), "r");
+	if (jobs.processed != NULL)
+	{
+		while (fgets(line, sizeof(line), jobs.processed) != NULL)
+		{
+			size_t length = strlen(line);
+
+			// A partial line from being stopped mid write isn't a file
+			if (length > 0 && line[length - 1] == '\n')
+			{
+				line[length - 1] = 0;
+				jobs.done.insert(line);
+			}
+		}
+		fclose(jobs.processed);
+	}
+	jobs.processed = fopen(recordName.c_str(), "a");
+	if (jobs.processed == NULL)
+	{
+		perror("Error: Can't open the record of processed files");
+		return 1;
+	}
+
+	// Watch before listing so a file closed in between isn't missed
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, dirName, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		perror("Error: Can't watch the directory");
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		fclose(jobs.processed);
+		return 1;
+	}
+	fprintf(stdout, "Watching \"%s\"\n", dirName);
+	fflush(stdout);
+	error = queueDirectory(jobs);
+	for (uint32_t i = 0; i < options.jobs; i++)
+	{
+		threads.push_back(std::thread(runWatchThread, &jobs));
+	}
+
+	while (!error)
+	{
+		ssize_t size = read(fd, events, sizeof(events));
+
+		if (size <= 0)
+		{
+			if (size < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			perror("read");
+			error = 1;
+			break;
+		}
+		for (ssize_t i = 0; i < size; )
+		{
+			const inotify_event *event = (const inotify_event*) (events + i);
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				error = queueDirectory(jobs);
+			}
+			else if (event->mask & IN_IGNORED)
+			{
+				fprintf(stderr, "Error: \"%s\" is no longer watched\n", dirName);
+				error = 1;
+			}
+			else if (event->len > 0 && !(event->mask & IN_ISDIR))
+			{
+				queueWatched(jobs, event->name);
+			}
+			i += sizeof(inotify_event) + event->len;
+		}
+	}
+
+	// Finish the queued files
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+
+		jobs.stop = 1;
+		jobs.added.notify_all();
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	close(fd);
+	if (fclose(jobs.processed))
+	{
+		perror("fclose");
+		error = 1;
+	}
+	return error;
+}
+
+/**
+ * Outputs the time spent in each stage of the pipeline to stderr.
+ */
+void printStats()
+{
+	fprintf(stderr, "Stats: read %0.3f s, threshold %0.3f s, spans %0.3f s, output %0.3f s, passes %0.3f s\n",
+		stats.busy[STAGE_READ]      / 1e9,
+		stats.busy[STAGE_THRESHOLD] / 1e9,
+		stats.busy[STAGE_SPANS]     / 1e9,
+		stats.busy[STAGE_COUNT]     / 1e9,
+		stats.wall                  / 1e9);
+	if (stats.cacheHits + stats.cacheMisses != 0)
+	{
+		fprintf(stderr, "Stats: cache %" PRIu64 " hits, %" PRIu64 " misses\n", (uint64_t) stats.cacheHits, (uint64_t) stats.cacheMisses);
+	}
+
+	const char *largeNames[LARGE_COUNT] = {"counts", "blocks", "samples"};
+
+	for (uint32_t i = 0; i < LARGE_COUNT; i++)
+	{
+		const std::atomic<uint64_t> *bytes = stats.largeBytes[i];
+
+		if (bytes[PAGES_EXPLICIT] + bytes[PAGES_TRANSPARENT] + bytes[PAGES_NORMAL] != 0)
+		{
+			fprintf(stderr, "Stats: %s %0.1f MiB explicit huge pages, %0.1f MiB transparent huge pages requested, %0.1f MiB normal pages\n",
+				largeNames[i],
+				bytes[PAGES_EXPLICIT]    / 1048576.0,
+				bytes[PAGES_TRANSPARENT] / 1048576.0,
+				bytes[PAGES_NORMAL]      / 1048576.0);
+		}
+	}
+}
+
+/**
+ * Outputs how to use the program.
+ *
+ * @param name - The program's name
+ */
+void printUsage(const char *name)
+{
+	fprintf(stderr,
+		"usage:\n\"%s\" [options] file-name\n\"%s\" [options] --continuous file-name...\n"
+		"\n"
+		"options:\n"
+		"  --spectrogram  File is I/Q (channel 0 is I and channel 1 is Q). Only demodulates\n"
+		"                 the frequency bins and time ranges that have activity\n"
+		"  --fft-size N   FFT size for --spectrogram (default %u)\n"
+		"  --activity dB  How far above the noise floor is activity (default %0.1f)\n"
+		"  --splatter dB  Ignores activity this far below activity at the same time (default\n"
+		"                 %0.1f, 0 keeps everything)\n"
+		"  --hangover N   Max samples between activity in the same region or burst (default %u)\n"
+		"  --jobs N       Decodes N regions at a time for --spectrogram, N bursts at a time\n"
+		"                 for --bursts or N files at a time for --watch (default 1). Output\n"
+		"                 is the same as 1 job except --watch outputs files as they finish\n"
+		"  --downconvert Hz|auto\n"
+		"                 Mixes the carrier at Hz (or the strongest one) down to 0 Hz and low\n"
+		"                 pass filters before demodulating. The file is real (IF) unless --iq\n"
+		"  --fsk          Demodulates the frequency (FSK) instead of the amplitude, the higher\n"
+		"                 tone is on. The file is I/Q at 0 Hz unless --downconvert\n"
+		"  --decimate N   Decimation after --downconvert or --fsk (default %u)\n"
+		"  --iq           File is I/Q (channel 0 is I and channel 1 is Q)\n"
+		"  --sample-rate Hz\n"
+		"                 Sample rate of raw files\n"
+		"  --preamble BITS\n"
+		"                 Finds packets by correlating with the preamble (0s and 1s) instead of\n"
+		"                 thresholding everything. Works much closer to the noise floor\n"
+		"  --bit-width N  Samples per bit for --preamble (default measured)\n"
+		"  --packet-bits N\n"
+		"                 Bits per packet including the preamble (default ends at %u off bits)\n"
+		"  --correlation N\n"
+		"                 How many times the noise a correlation peak is (default %0.1f)\n"
+		"  --multi-threshold\n"
+		"                 Tries %u thresholds across the on/off range in one pass and uses the\n"
+		"                 one whose spans fit a bit width the thresholds agree on with the\n"
+		"                 lowest error\n"
+		"  --flicker N|auto\n"
+		"                 Samples in a row needed to change between on and off (default %u).\n"
+		"                 auto measures the bit width then tries %u flickers from 1/4 of a bit,\n"
+		"                 halving each time, and uses the one whose spans fit their bit width\n"
+		"                 best. Their spans are counted from the on/off state of each sample\n"
+		"                 kept in memory instead of reading the file again\n"
+		"  --threshold-level N\n"
+		"                 Where the threshold is from off (0) to on (1) (default 0.5)\n"
+		"  --tune         Tries %u threshold levels, %u flickers and with --rectify 3\n"
+		"                 windows on the --start/--end window, --prefix or the first %u\n"
+		"                 samples, a job per core unless --jobs, and outputs the best as\n"
+		"                 options. With --match the best decodes the most messages with those\n"
+		"                 bits\n"
+		"  --rectify      File is AC coupled audio where on is a tone. Removes DC, full-wave\n"
+		"                 rectifies and low pass filters before demodulating\n"
+		"  --rectify-window N\n"
+		"                 Low pass filter length for --rectify, longer than a period of the tone\n"
+		"                 and shorter than a bit (default %u)\n"
+		"  --bursts       Finds bursts and normalizes each to its own floor and peak so weak and\n"
+		"                 strong devices in the same file are decoded\n"
+		"  --extract DIR  Writes each burst to DIR as a .wav file in the file's sample format\n"
+		"                 named by its first sample (implies --bursts)\n"
+		"  --archive FILE Writes the bursts (implies --bursts) as they are in the file and the\n"
+		"                 length and levels of the samples between them to FILE. Decoding\n"
+		"                 FILE outputs the same bursts and data\n"
+		"  --padding TIME[,TIME]\n"
+		"                 Keeps TIME before and after (or TIME before, TIME after) the active\n"
+		"                 samples of each --extract burst instead of its margins\n"
+		"  --burst-level N\n"
+		"                 How many median absolute deviations above the median is activity\n"
+		"                 (default %0.1f)\n"
+		"  --overview FILE\n"
+		"                 Writes the min, max and energy of every 256, 64K and 16M samples to\n"
+		"                 FILE while counting samples\n"
+		"  --query-overview N\n"
+		"                 file-name is an --overview file. Outputs the activity of every N\n"
+		"                 seconds (or samples if the sample rate isn't known) from it alone.\n"
+		"                 Uses --activity as how far above the median range is active\n"
+		"  --write-index FILE\n"
+		"                 Writes the bursts (--bursts) with their margins and levels to FILE\n"
+		"  --index FILE   Reads the bursts from a --write-index file instead of finding them\n"
+		"                 and only reads those samples (implies --bursts)\n"
+		"  --cache DIR    Outputs the result of a file decoded with the same options from DIR\n"
+		"                 without reading it, otherwise adds the result to DIR. A file is the\n"
+		"                 same if its device, inode, size and modification time are the same\n"
+		"  --export-pulses FILE\n"
+		"                 Writes the spans as rtl_433 OOK pulse data to FILE, a package per\n"
+		"                 burst ending at %u off bits. Needs the sample rate\n"
+		"  --import-pulses\n"
+		"                 file-name is rtl_433 OOK pulse data. Finds the bit width of each\n"
+		"                 package from its pulses and gaps at the file's sample rate (or\n"
+		"                 --sample-rate or 48000) and outputs its data\n"
+		"  --continuous   The files are a recording split into files in order. Decodes them as\n"
+		"                 one stream so transmissions across files aren't lost\n"
+		"  --watch        file-name is a directory. Decodes its files and then each file\n"
+		"                 written or moved into it when it's closed with --jobs workers.\n"
+		"                 Decoded files are recorded so they aren't decoded again\n"
+		"  --processed FILE\n"
+		"                 The record for --watch (default .demodulate-ook-processed in the\n"
+		"                 directory)\n"
+		"  --max-messages N\n"
+		"                 Outputs messages (ending at %u off bits, or --preamble packets) and\n"
+		"                 stops reading after N of them\n"
+		"  --match BITS   Only outputs messages with BITS (0s and 1s or hex starting with 0x)\n"
+		"                 and stops after the first one (or --max-messages of them)\n"
+		"  --prefix N     Finds the threshold and bit width from the first N seconds (or\n"
+		"                 samples if the sample rate isn't known) instead of all of them\n"
+		"  --start TIME   Seeks to TIME and only decodes from there. TIME is seconds, [H:]M:S\n"
+		"                 or a sample number ending in s (like 48000s)\n"
+		"  --end TIME     Stops decoding at TIME\n"
+		"  --memory-limit N\n"
+		"                 Plans the decode to use less than N bytes (or NK, NM or NG): counts\n"
+		"                 fewer bits of 24 and 32 bit samples, reads a block at a time and\n"
+		"                 uses fewer --jobs. Outputs the plan\n"
+		"  --pipeline     Runs reading, thresholding, finding spans and output on their own\n"
+		"                 threads\n"
+		"  --stats        Outputs the time spent in each stage and which large buffers got\n"
+		"                 huge pages to stderr\n"
+		"  --kernels name Uses the avx512, avx2, sse4 or generic kernels instead of the best\n"
+		"                 the CPU supports\n",
+		name, name, SPECTROGRAM_FFT_SIZE, SPECTROGRAM_ACTIVITY_DB, SPECTROGRAM_SPLATTER_DB, SPECTROGRAM_HANGOVER, DOWNCONVERT_DECIMATION,
+		PREAMBLE_GAP_BITS, PREAMBLE_CORRELATION, THRESHOLD_CANDIDATES, RADIO_FLICKER, AUTO_FLICKER_CANDIDATES, TUNE_LEVELS, TUNE_FLICKERS, TUNE_MAX_SAMPLES, RECTIFY_WINDOW, BURST_LEVEL, PREAMBLE_GAP_BITS,
+		PREAMBLE_GAP_BITS);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t   error;
+	const char *fileName = NULL;
+	const char *pulseName = NULL;
+	std::vector<const char*> fileNames;
+	std::string matchBits;
+	const char *kernelName = NULL;
+	decodeOptions options;
+
+	options.spectrogram = 0;
+	options.fftSize     = SPECTROGRAM_FFT_SIZE;
+	options.activityDb  = SPECTROGRAM_ACTIVITY_DB;
+	options.splatterDb  = SPECTROGRAM_SPLATTER_DB;
+	options.hangover    = SPECTROGRAM_HANGOVER;
+	options.pipelined   = 0;
+	options.stats       = 0;
+	options.jobs        = 0; // 1, or a job per core with --tune, unless --jobs
+	options.iq          = 0;
+	options.downconvert = 0;
+	options.carrierAuto = 0;
+	options.fsk         = 0;
+	options.carrierHz   = 0;
+	options.decimation  = DOWNCONVERT_DECIMATION;
+	options.sampleRate  = 0;
+	options.preamble    = NULL;
+	options.bitWidth    = 0;
+	options.packetBits  = 0;
+	options.correlation = PREAMBLE_CORRELATION;
+	options.bursts      = 0;
+	options.burstLevel  = BURST_LEVEL;
+	options.rectify     = 0;
+	options.multiThreshold = 0;
+	options.overview    = NULL;
+	options.queryStep   = 0;
+	options.writeIndex  = NULL;
+	options.readIndex   = NULL;
+	options.cacheDir    = NULL;
+	options.pulseFile   = NULL;
+	options.importPulses = 0;
+	options.continuous  = 0;
+	options.watch       = 0;
+	options.processed   = NULL;
+	options.maxMessages = 0;
+	options.match       = NULL;
+	options.prefix      = 0;
+	options.start       = NULL;
+	options.end         = NULL;
+	options.memoryLimit = 0;
+	options.countShift  = 0;
+	options.extract     = NULL;
+	options.padding     = NULL;
+	options.windowStart = 0;
+	options.archive     = NULL;
+	options.flicker     = RADIO_FLICKER;
+	options.thresholdLevel = 0.5;
+	options.tune        = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--spectrogram") == 0)
+		{
+			options.spectrogram = 1;
+		}
+		else if (strcmp(argv[i], "--fft-size") == 0 && i + 1 < argc)
+		{
+			options.fftSize = (uint32_t) strtoul(argv[++i], NULL, 10);
+			if (options.fftSize < 16 || options.fftSize > 65536 || (options.fftSize & (options.fftSize - 1)) != 0)
+			{
+				fprintf(stderr, "Error: FFT size must be a power of 2 from 16 to 65536\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--activity") == 0 && i + 1 < argc)
+		{
+			options.activityDb = strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--splatter") == 0 && i + 1 < argc)
+		{
+			options.splatterDb = strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--hangover") == 0 && i + 1 < argc)
+		{
+			options.hangover = (uint32_t) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--iq") == 0)
+		{
+			options.iq = 1;
+		}
+		else if (strcmp(argv[i], "--downconvert") == 0 && i + 1 < argc)
+		{
+			options.downconvert = 1;
+			if (strcmp(argv[++i], "auto") == 0)
+			{
+				options.carrierAuto = 1;
+			}
+			else
+			{
+				options.carrierHz = strtod(argv[i], NULL);
+			}
+		}
+		else if (strcmp(argv[i], "--fsk") == 0)
+		{
+			options.fsk = 1;
+		}
+		else if (strcmp(argv[i], "--decimate") == 0 && i + 1 < argc)
+		{
+			options.decimation = (uint32_t) strtoul(argv[++i], NULL, 10);
+			if (options.decimation < 1 || options.decimation > 65536)
+			{
+				fprintf(stderr, "Error: Decimation must be from 1 to 65536\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc)
+		{
+			options.sampleRate = (uint32_t) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--preamble") == 0 && i + 1 < argc)
+		{
+			options.preamble = argv[++i];
+			if (strspn(options.preamble, "01") != strlen(options.preamble) ||
+			    strchr(options.preamble, '0') == NULL ||
+			    strchr(options.preamble, '1') == NULL)
+			{
+				fprintf(stderr, "Error: Preamble must be 0s and 1s with at least one of each\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-messages") == 0 && i + 1 < argc)
+		{
+			options.maxMessages = (uint32_t) strtoul(argv[++i], NULL, 10);
+			if (options.maxMessages == 0)
+			{
+				fprintf(stderr, "Error: Max messages must be at least 1\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--match") == 0 && i + 1 < argc)
+		{
+			const char *pattern = argv[++i];
+
+			// Hex is 4 bits a digit
+			matchBits.clear();
+			if (strncmp(pattern, "0x", 2) == 0)
+			{
+				pattern += 2;
+				if (strspn(pattern, "0123456789abcdefABCDEF") != strlen(pattern))
+				{
+					pattern = "";
+				}
+				for (const char *digit = pattern; *digit != 0; digit++)
+				{
+					const char *hexDigits = "0123456789abcdef";
+					uint32_t    nibble    = (uint32_t) (strchr(hexDigits, *digit | 0x20) - hexDigits);
+
+					for (int bit = 3; bit >= 0; bit--)
+					{
+						matchBits += (char) ('0' + ((nibble >> bit) & 1));
+					}
+				}
+			}
+			else if (strspn(pattern, "01") == strlen(pattern))
+			{
+				matchBits = pattern;
+			}
+			if (matchBits.empty())
+			{
+				fprintf(stderr, "Error: Match must be 0s and 1s or hex starting with 0x\n");
+				return 1;
+			}
+			options.match = matchBits.c_str();
+		}
+		else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc)
+		{
+			options.prefix = strtod(argv[++i], NULL);
+			if (!(options.prefix > 0))
+			{
+				fprintf(stderr, "Error: Prefix must be more than 0\n");
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i], "--start") == 0 || strcmp(argv[i], "--end") == 0) && i + 1 < argc)
+		{
+			uint64_t sample;
+
+			// Times are checked again with the sample rate
+			if (parseTime(argv[i + 1], 1, &sample))
+			{
+				return 1;
+			}
+			if (argv[i][2] == 's')
+			{
+				options.start = argv[++i];
+			}
+			else
+			{
+				options.end = argv[++i];
+			}
+		}
+		else if (strcmp(argv[i], "--bit-width") == 0 && i + 1 < argc)
+		{
+			options.bitWidth = strtod(argv[++i], NULL);
+			if (!(options.bitWidth >= 1))
+			{
+				fprintf(stderr, "Error: Bit width must be at least 1 sample\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--packet-bits") == 0 && i + 1 < argc)
+		{
+			options.packetBits = (uint32_t) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--correlation") == 0 && i + 1 < argc)
+		{
+			options.correlation = strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--multi-threshold") == 0)
+		{
+			options.multiThreshold = 1;
+		}
+		else if (strcmp(argv[i], "--flicker") == 0 && i + 1 < argc)
+		{
+			if (strcmp(argv[++i], "auto") == 0)
+			{
+				options.flicker = 0;
+			}
+			else
+			{
+				options.flicker = (uint32_t) strtoul(argv[i], NULL, 10);
+				if (options.flicker < 1 || options.flicker > MAX_SPAN)
+				{
+					fprintf(stderr, "Error: Flicker must be from 1 to %u samples or auto\n", MAX_SPAN);
+					return 1;
+				}
+			}
+		}
+		else if (strcmp(argv[i], "--threshold-level") == 0 && i + 1 < argc)
+		{
+			options.thresholdLevel = strtod(argv[++i], NULL);
+			if (!(options.thresholdLevel > 0 && options.thresholdLevel < 1))
+			{
+				fprintf(stderr, "Error: Threshold level must be between 0 and 1\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--tune") == 0)
+		{
+			options.tune = 1;
+		}
+		else if (strcmp(argv[i], "--rectify") == 0)
+		{
+			options.rectify = RECTIFY_WINDOW;
+		}
+		else if (strcmp(argv[i], "--rectify-window") == 0 && i + 1 < argc)
+		{
+			options.rectify = (uint32_t) strtoul(argv[++i], NULL, 10);
+			if (options.rectify < 1 || options.rectify > 65536)
+			{
+				fprintf(stderr, "Error: Rectify window must be from 1 to 65536\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--bursts") == 0)
+		{
+			options.bursts = 1;
+		}
+		else if (strcmp(argv[i], "--extract") == 0 && i + 1 < argc)
+		{
+			options.extract = argv[++i];
+			options.bursts  = 1;
+		}
+		else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc)
+		{
+			options.archive = argv[++i];
+			options.bursts  = 1;
+		}
+		else if (strcmp(argv[i], "--padding") == 0 && i + 1 < argc)
+		{
+			options.padding = argv[++i];
+		}
+		else if (strcmp(argv[i], "--burst-level") == 0 && i + 1 < argc)
+		{
+			options.burstLevel = strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--overview") == 0 && i + 1 < argc)
+		{
+			options.overview = argv[++i];
+		}
+		else if (strcmp(argv[i], "--query-overview") == 0 && i + 1 < argc)
+		{
+			options.queryStep = strtod(argv[++i], NULL);
+			if (!(options.queryStep > 0))
+			{
+				fprintf(stderr, "Error: Query step must be more than 0\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--write-index") == 0 && i + 1 < argc)
+		{
+			options.writeIndex = argv[++i];
+			options.bursts     = 1;
+		}
+		else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+		{
+			options.readIndex = argv[++i];
+			options.bursts    = 1;
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+		{
+			options.cacheDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--export-pulses") == 0 && i + 1 < argc)
+		{
+			pulseName = argv[++i];
+		}
+		else if (strcmp(argv[i], "--import-pulses") == 0)
+		{
+			options.importPulses = 1;
+		}
+		else if (strcmp(argv[i], "--continuous") == 0)
+		{
+			options.continuous = 1;
+		}
+		else if (strcmp(argv[i], "--watch") == 0)
+		{
+			options.watch = 1;
+		}
+		else if (strcmp(argv[i], "--processed") == 0 && i + 1 < argc)
+		{
+			options.processed = argv[++i];
+		}
+		else if (strcmp(argv[i], "--pipeline") == 0)
+		{
+			options.pipelined = 1;
+		}
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			options.stats = 1;
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+			options.jobs = (uint32_t) strtoul(argv[++i], NULL, 10);
+			if (options.jobs < 1 || options.jobs > 256)
+			{
+				fprintf(stderr, "Error: Jobs must be from 1 to 256\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc)
+		{
+			char *end;
+
+			options.memoryLimit = strtoull(argv[++i], &end, 10);
+			if (*end == 'K' || *end == 'k')
+			{
+				options.memoryLimit <<= 10;
+				end++;
+			}
+			else if (*end == 'M' || *end == 'm')
+			{
+				options.memoryLimit <<= 20;
+				end++;
+			}
+			else if (*end == 'G' || *end == 'g')
+			{
+				options.memoryLimit <<= 30;
+				end++;
+			}
+			if (options.memoryLimit == 0 || *end != 0)
+			{
+				fprintf(stderr, "Error: Memory limit must be bytes or a number ending in K, M or G\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--kernels") == 0 && i + 1 < argc)
+		{
+			kernelName = argv[++i];
+		}
+		else if (argv[i][0] != '-')
+		{
+			fileNames.push_back(argv[i]);
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (fileNames.empty() || (fileNames.size() > 1 && !options.continuous))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+	if (options.jobs == 0)
+	{
+		options.jobs = options.tune ? std::min(std::max(std::thread::hardware_concurrency(), 1U), 256U) : 1;
+	}
+	fileName = fileNames[0];
+	if (options.queryStep > 0)
+	{
+		return queryOverview(fileName, options.queryStep, options.activityDb, stdout) ? 1 : 0;
+	}
+	if (selectKernels(kernelName))
+	{
+		return 1;
+	}
+	printf("Using %s kernels\n", kernels.name);
+	if (options.spectrogram && options.downconvert)
+	{
+		fprintf(stderr, "Error: --spectrogram already mixes each region down, it can't be used with --downconvert\n");
+		return 1;
+	}
+	if (options.rectify && (options.spectrogram || options.downconvert))
+	{
+		fprintf(stderr, "Error: --rectify is for audio, --spectrogram and --downconvert make their own envelope\n");
+		return 1;
+	}
+	if ((options.writeIndex != NULL || options.readIndex != NULL) && (options.spectrogram || options.downconvert))
+	{
+		fprintf(stderr, "Error: --write-index and --index are of the file's samples, --spectrogram and --downconvert find bursts in what they demodulate\n");
+		return 1;
+	}
+	if (options.overview != NULL && (options.spectrogram || options.downconvert))
+	{
+		fprintf(stderr, "Error: --overview is of the samples demodulated, --spectrogram and --downconvert don't demodulate the file's samples\n");
+		return 1;
+	}
+	if (options.continuous && (options.spectrogram || options.downconvert || options.importPulses))
+	{
+		fprintf(stderr, "Error: --continuous is for sample streams, --spectrogram, --downconvert and --import-pulses read one file\n");
+		return 1;
+	}
+	if (options.watch && (options.continuous || options.overview != NULL || options.writeIndex != NULL || options.readIndex != NULL || pulseName != NULL ||
+	                      options.cacheDir != NULL))
+	{
+		fprintf(stderr, "Error: --watch decodes each file on its own, --continuous, --overview, --write-index, --index, --export-pulses and --cache are for one decode\n");
+		return 1;
+	}
+	if (options.extract != NULL && (options.spectrogram || options.downconvert || options.watch))
+	{
+		fprintf(stderr, "Error: --extract copies the bursts of one file's samples, --spectrogram and --downconvert demodulate them and --watch decodes many files\n");
+		return 1;
+	}
+	if (options.tune && (options.bursts || options.spectrogram || options.downconvert || options.preamble != NULL || options.watch))
+	{
+		fprintf(stderr, "Error: --tune measures one stream of samples, not --bursts, --spectrogram, --downconvert, --preamble or --watch\n");
+		return 1;
+	}
+	if (options.flicker == 0 && options.multiThreshold)
+	{
+		fprintf(stderr, "Error: --flicker auto keeps the on/off states of one threshold, --multi-threshold tries several\n");
+		return 1;
+	}
+	if (options.fsk && (options.spectrogram || options.rectify || options.writeIndex != NULL || options.readIndex != NULL ||
+	    options.overview != NULL || options.continuous || options.extract != NULL || options.archive != NULL || options.tune))
+	{
+		fprintf(stderr, "Error: --fsk demodulates one file's I/Q, it can't be used with --spectrogram, --rectify, --write-index, --index, --overview, --continuous, --extract, --archive or --tune\n");
+		return 1;
+	}
+	if (options.archive != NULL && (options.spectrogram || options.downconvert || options.watch))
+	{
+		fprintf(stderr, "Error: --archive keeps the bursts of one file's samples, --spectrogram and --downconvert demodulate them and --watch decodes many files\n");
+		return 1;
+	}
+	if (options.padding != NULL && options.extract == NULL)
+	{
+		fprintf(stderr, "Error: --padding is for --extract\n");
+		return 1;
+	}
+	if ((options.maxMessages != 0 || options.match != NULL) && (options.bursts || options.spectrogram))
+	{
+		fprintf(stderr, "Error: --max-messages and --match stop a single decode, --bursts and --spectrogram decode many\n");
+		return 1;
+	}
+	if ((options.start != NULL || options.end != NULL) && (options.continuous || options.importPulses || options.overview != NULL || options.writeIndex != NULL || options.readIndex != NULL))
+	{
+		fprintf(stderr, "Error: --start and --end seek in one file of samples, --continuous, --import-pulses, --overview, --write-index and --index are of whole files\n");
+		return 1;
+	}
+	if (options.match != NULL && options.maxMessages == 0)
+	{
+		// The first match
+		options.maxMessages = 1;
+	}
+	if (options.spectrogram || (options.fsk && !options.downconvert))
+	{
+		options.iq = 1;
+	}
+	if (pulseName != NULL)
+	{
+		if (options.preamble != NULL || options.spectrogram || options.importPulses || options.jobs > 1)
+		{
+			fprintf(stderr, "Error: --export-pulses needs spans in order, not --preamble, --spectrogram, --import-pulses or --jobs\n");
+			return 1;
+		}
+		options.pulseFile = fopen(pulseName, "w");
+		if (options.pulseFile == NULL)
+		{
+			perror("fopen");
+			return 1;
+		}
+		fprintf(options.pulseFile, ";pulse data\n;version 1\n;timescale 1us\n");
+	}
+
+	// Files written along the way need a decode
+	if (options.watch)
+	{
+		error = watchDirectory(fileName, options.processed, options);
+	}
+	else if (options.continuous)
+	{
+		error = decodeFiles(fileNames.data(), (uint32_t) fileNames.size(), options, stdout);
+	}
+	else if (options.cacheDir != NULL && options.overview == NULL && options.writeIndex == NULL && options.readIndex == NULL && options.pulseFile == NULL &&
+	         options.extract == NULL && options.archive == NULL)
+	{
+		error = decodeCached(fileName, options, argc, argv, stdout);
+	}
+	else
+	{
+		error = decodeFile(fileName, options, stdout);
+	}
+	if (options.pulseFile != NULL && fclose(options.pulseFile))
+	{
+		perror("fclose");
+		error = 1;
+	}
+	if (options.stats)
+	{
+		printStats();
+	}
+	return error ? 1 : 0;
 }
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""
+Regression tests on --bursts: decoding an --archive of a capture outputs the same bursts and data
+as decoding the capture, and --jobs output is the same as with 1 job. The capture has bursts of
+different strengths and bit widths between long idle gaps.
+
+usage: bursts.py [path to demodulate-ook]
+"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+SAMPLE_RATE = 48000
+BURSTS      = [('aa55f0f0cafe', 20000, 100), ('c3a5a5', 3000, 50), ('deadbeef', 12000, 80), ('f00d', 1500, 100), ('a5a5a5a5', 20000, 40)]
+
+def writeCapture(fileName):
+	random.seed(1)
+	levels = [0] * 20000
+	for message, amplitude, width in BURSTS:
+		for digit in message:
+			for bit in format(int(digit, 16), '04b'):
+				levels += [amplitude * int(bit)] * width
+		levels += [0] * 30000
+	data = b''.join(struct.pack('<h', int(level + random.gauss(0, 300))) for level in levels)
+	header = struct.pack('<4sI4s4sIHHIIHH4sI', b'RIFF', 36 + len(data), b'WAVE', b'fmt ', 16, 1, 1,
+		SAMPLE_RATE, 2 * SAMPLE_RATE, 2, 16, b'data', len(data))
+	with open(fileName, 'wb') as f:
+		f.write(header + data)
+
+def decode(program, args, fileName):
+	result = subprocess.run([program] + args + [fileName], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+	return result.stdout.splitlines()
+
+def getBursts(lines):
+	"""Gets the output from the number of bursts on, which doesn't depend on the file type."""
+	for i in range(len(lines)):
+		if lines[i].startswith('Bursts: '):
+			return lines[i:]
+	return lines
+
+def main():
+	program  = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), '..', 'demodulate-ook'))
+	failures = 0
+
+	with tempfile.TemporaryDirectory() as directory:
+		fileName    = os.path.join(directory, 'bursts.wav')
+		archiveName = os.path.join(directory, 'bursts.ooka')
+		writeCapture(fileName)
+
+		serial = getBursts(decode(program, ['--bursts'], fileName))
+		found  = [line for line in serial if all(c in '0123456789abcdef' for c in line) and line]
+		if found != [message for message, amplitude, width in BURSTS]:
+			print('FAIL --bursts: %s' % found)
+			failures += 1
+
+		decode(program, ['--bursts', '--archive', archiveName], fileName)
+		for args in [[], ['--jobs', '3']]:
+			if getBursts(decode(program, args, archiveName)) != serial:
+				print('FAIL decoding the archive %s isn\'t the same as --bursts' % ' '.join(args))
+				failures += 1
+
+		for jobs in ['2', '3', '8']:
+			for args in [['--bursts'], ['--bursts', '--preamble', '1010']]:
+				lines = getBursts(decode(program, args + ['--jobs', jobs], fileName))
+				if lines != getBursts(decode(program, args, fileName)):
+					print('FAIL %s --jobs %s isn\'t the same as with 1 job' % (' '.join(args), jobs))
+					failures += 1
+
+	print('%s' % ('FAILED' if failures else 'OK'))
+	return 1 if failures else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Regression tests on an oversampled capture with glitches. 400 samples/bit, 8 sample glitches
+every 75 to 225 samples. The default flicker measures the bit width between glitches instead, so
+--flicker auto and the --tune profile have to find a longer flicker.
+
+usage: glitches.py [path to demodulate-ook]
+"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+BIT_WIDTH   = 400
+SAMPLE_RATE = 48000
+MESSAGE     = 'aa55f0f0cafe'
+
+def writeCapture(fileName):
+	random.seed(1)
+	states = [0] * 4000
+	for digit in MESSAGE:
+		for bit in format(int(digit, 16), '04b'):
+			states += [int(bit)] * BIT_WIDTH
+	states += [0] * 4000
+	i = random.randrange(150)
+	while i < len(states) - 8:
+		for j in range(i, i + 8):
+			states[j] ^= 1
+		i += random.randrange(75, 225)
+	data = b''.join(struct.pack('<h', int(20000 * state + random.gauss(0, 300))) for state in states)
+	header = struct.pack('<4sI4s4sIHHIIHH4sI', b'RIFF', 36 + len(data), b'WAVE', b'fmt ', 16, 1, 1,
+		SAMPLE_RATE, 2 * SAMPLE_RATE, 2, 16, b'data', len(data))
+	with open(fileName, 'wb') as f:
+		f.write(header + data)
+
+def decode(program, args, fileName):
+	result = subprocess.run([program] + args + [fileName], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+	return result.stdout.splitlines()
+
+def main():
+	program  = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), '..', 'demodulate-ook'))
+	failures = 0
+
+	with tempfile.TemporaryDirectory() as directory:
+		fileName = os.path.join(directory, 'glitches.wav')
+		writeCapture(fileName)
+
+		lines = decode(program, ['--flicker', 'auto'], fileName)
+		if lines[-1] != MESSAGE:
+			print('FAIL --flicker auto: ' + lines[-1])
+			failures += 1
+
+		lines   = decode(program, ['--tune', '--jobs', '1'], fileName)
+		profile = [line for line in lines if line.startswith('Profile: ')]
+		if 'Trying 72 settings with 1 jobs...' not in lines:
+			print('FAIL --tune --jobs 1 didn\'t use 1 job')
+			failures += 1
+		if not profile:
+			print('FAIL --tune: no profile')
+			failures += 1
+		else:
+			lines = decode(program, profile[0].split()[1:], fileName)
+			if lines[-1] != MESSAGE:
+				print('FAIL --tune profile "%s": %s' % (profile[0], lines[-1]))
+				failures += 1
+
+	print('%s' % ('FAILED' if failures else 'OK'))
+	return 1 if failures else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""
+Regression tests on the sample numbers messages are output at, since they're what's used to find
+a message in the capture again. Messages of 100 samples/bit with gaps of 8000 samples, each starting
+with the same preamble.
+
+usage: positions.py [path to demodulate-ook]
+"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+BIT_WIDTH   = 100
+GAP         = 8000
+SAMPLE_RATE = 48000
+MESSAGES    = ['aa55f0f0cafe', 'aa55c3a5', 'aa55deadbeef']
+PREAMBLE    = '1010101001010101'
+
+def writeCapture(fileName):
+	"""Writes the capture and returns the first sample of each message."""
+	random.seed(1)
+	states = [0] * 4000
+	starts = []
+	for message in MESSAGES:
+		starts.append(len(states))
+		for digit in message:
+			for bit in format(int(digit, 16), '04b'):
+				states += [int(bit)] * BIT_WIDTH
+		states += [0] * GAP
+	data = b''.join(struct.pack('<h', int(20000 * state + random.gauss(0, 300))) for state in states)
+	header = struct.pack('<4sI4s4sIHHIIHH4sI', b'RIFF', 36 + len(data), b'WAVE', b'fmt ', 16, 1, 1,
+		SAMPLE_RATE, 2 * SAMPLE_RATE, 2, 16, b'data', len(data))
+	with open(fileName, 'wb') as f:
+		f.write(header + data)
+	return starts
+
+def decode(program, args, fileName):
+	result = subprocess.run([program] + args + [fileName], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+	return result.stdout.splitlines()
+
+def getStarts(lines, prefix):
+	"""Gets the sample numbers of lines like "<prefix> 1 at sample N, ..."."""
+	return [int(line.split(' at sample ')[1].split(',')[0].split(':')[0]) for line in lines if line.startswith(prefix + ' ')]
+
+def main():
+	program  = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), '..', 'demodulate-ook'))
+	failures = 0
+
+	with tempfile.TemporaryDirectory() as directory:
+		fileName = os.path.join(directory, 'positions.wav')
+		starts   = writeCapture(fileName)
+
+		# Samples are numbered from --start
+		for first in [0, 12000]:
+			args   = ['--max-messages', '10'] + (['--start', '%ds' % first] if first else [])
+			found  = getStarts(decode(program, args, fileName), 'Message')
+			wanted = [start - first for start in starts if start >= first]
+			if found != wanted:
+				print('FAIL %s: messages at %s instead of %s' % (' '.join(args), found, wanted))
+				failures += 1
+
+		# Only the packets between --start and --end, and none past the end of the file
+		for first, end in [(0, None), (12000, 26000)]:
+			args   = ['--preamble', PREAMBLE, '--bit-width', str(BIT_WIDTH)] + (['--start', '%ds' % first, '--end', '%ds' % end] if end else [])
+			found  = getStarts(decode(program, args, fileName), 'Packet')
+			wanted = [start - first for start in starts if start >= first and (end is None or start < end)]
+			if found != wanted:
+				print('FAIL %s: packets at %s instead of %s' % (' '.join(args), found, wanted))
+				failures += 1
+
+	print('%s' % ('FAILED' if failures else 'OK'))
+	return 1 if failures else 0
+
+if __name__ == '__main__':
+	sys.exit(main())